@@ -0,0 +1,282 @@
+// board - measures how fast the server judges moves: the old grid-string checks against the bitboards
+//     Optional argument is the number of games to replay (default 1000000)
+//     Every game is a random sequence of moves played until someone wins or the board fills;
+//     after each move both versions answer "did the mover win?" and "is the board full?"
+//     The string version is the one ttts used before board.c, kept here as the baseline
+//     Then the same for -b 15,5 boards: the windows around the last move against scanning the whole grid
+//     Last, ultimate games: random legal games are recorded first, then replayed move by move,
+//     each move checked for legality, played and judged like the MOVE handler does
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../board.h"
+
+int checkForWin(char square[]){
+    int returnValue = 0;
+    if ((square[0] != '.') && (square[0] == square[1]) && (square[1] == square[2])) returnValue = 1;
+    else if ((square[3] != '.') &&(square[3] == square[4]) && (square[4] == square[5])) returnValue = 1;
+    else if ((square[6] != '.') &&(square[6] == square[7]) && (square[7] == square[8])) returnValue = 1;
+    else if ((square[0] != '.') &&(square[0] == square[4]) && (square[4] == square[8])) returnValue = 1;
+    else if ((square[2] != '.') &&(square[2] == square[4]) && (square[4] == square[6])) returnValue = 1;
+    else if ((square[0] != '.') &&(square[0] == square[3]) && (square[3] == square[6])) returnValue = 1;
+    else if ((square[1] != '.') &&(square[1] == square[4]) && (square[4] == square[7])) returnValue = 1;
+    else if ((square[2] != '.') &&(square[2] == square[5]) && (square[5] == square[8])) returnValue = 1;
+    else returnValue = -1;
+    return returnValue;
+}
+
+int checkForDraw(char square[]){
+    for (int i = 0; i < 9; i++) {
+        if (square[i] == '.') return 0;
+    }
+  return 1;
+}
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the moves of each game as "r,c" strings, like they arrive in MOVE, shuffled up front
+char (*games)[9][4];
+int ngames;
+
+void deal(void){
+    for (int g = 0; g < ngames; g++) {
+        int cells[9];
+        for (int i = 0; i < 9; i++) cells[i] = i;
+        for (int i = 8; i > 0; i--) {
+            int j = rand() % (i + 1), t = cells[i];
+            cells[i] = cells[j];
+            cells[j] = t;
+        }
+        for (int i = 0; i < 9; i++) {
+            games[g][i][0] = '1' + cells[i] / 3;
+            games[g][i][1] = ',';
+            games[g][i][2] = '1' + cells[i] % 3;
+            games[g][i][3] = '\0';
+        }
+    }
+}
+
+// parses the coordinates like the MOVE handler did and checks the grid after every move
+long run_strings(long *ended){
+    long moves = 0;
+    for (int g = 0; g < ngames; g++) {
+        char grid[10] = ".........";
+        for (int i = 0; i < 9; i++) {
+            char *c = games[g][i];
+            int sum = (c[0] - '1') * 3 + (c[2] - '1');
+            if (grid[sum] != '.') continue;
+            grid[sum] = i % 2 == 0 ? 'X' : 'O';
+            moves++;
+            if (checkForWin(grid) == 1 || checkForDraw(grid) == 1) {
+                (*ended)++;
+                break;
+            }
+        }
+    }
+    return moves;
+}
+
+long run_bitboards(long *ended){
+    long moves = 0;
+    for (int g = 0; g < ngames; g++) {
+        struct board b = { { 0, 0 } };
+        for (int i = 0; i < 9; i++) {
+            int cell = board_cell(games[g][i], 3);
+            if (board_play(&b, i % 2, cell) == -1) continue;
+            moves++;
+            if (board_won(&b, i % 2) || board_full(&b)) {
+                (*ended)++;
+                break;
+            }
+        }
+    }
+    return moves;
+}
+
+// gomoku games: random moves on a 15×15 grid until five in a row or WIDE_GAME_MOVES moves
+#define WIDE_SIDE 15
+#define WIDE_RUN 5
+#define WIDE_GAME_MOVES 120
+
+// the straightforward check: every cell, every direction, count the run starting there
+int scan_won(unsigned char *grid, unsigned char mark){
+    int dr[4] = { 0, 1, 1, 1 }, dc[4] = { 1, 0, 1, -1 };
+    for (int r = 0; r < WIDE_SIDE; r++) {
+        for (int c = 0; c < WIDE_SIDE; c++) {
+            for (int d = 0; d < 4; d++) {
+                int n = 0, rr = r, cc = c;
+                while (n < WIDE_RUN && rr >= 0 && rr < WIDE_SIDE && cc >= 0 && cc < WIDE_SIDE
+                        && grid[rr * WIDE_SIDE + cc] == mark) {
+                    n++;
+                    rr += dr[d];
+                    cc += dc[d];
+                }
+                if (n == WIDE_RUN) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// plays ngames / 100 random games both ways, returns the evaluations per second of each
+void run_wide(double *scan, double *windows){
+    int rounds = ngames / 100 > 0 ? ngames / 100 : 1;
+    long moves = 0, wonScan = 0, wonWindows = 0;
+    double tScan = 0, tWindows = 0;
+    int order[WIDE_SIDE * WIDE_SIDE];
+
+    wide_setup(WIDE_SIDE, WIDE_RUN); // first: the board's size depends on it
+    struct wideboard *b = malloc(wide_bytes());
+    for (int g = 0; g < rounds; g++) {
+        for (int i = 0; i < WIDE_SIDE * WIDE_SIDE; i++) order[i] = i;
+        for (int i = 0; i < WIDE_GAME_MOVES; i++) { // the first moves of a shuffle
+            int j = i + rand() % (WIDE_SIDE * WIDE_SIDE - i), t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+
+        unsigned char grid[WIDE_SIDE * WIDE_SIDE] = { 0 };
+        double t0 = now();
+        for (int i = 0; i < WIDE_GAME_MOVES; i++) {
+            grid[order[i]] = i % 2 + 1;
+            if (scan_won(grid, i % 2 + 1)) {
+                wonScan++;
+                break;
+            }
+        }
+        double t1 = now();
+        wide_clear(b);
+        for (int i = 0; i < WIDE_GAME_MOVES; i++) {
+            int row = order[i] / WIDE_SIDE, col = order[i] % WIDE_SIDE;
+            wide_play(b, i % 2, row, col);
+            moves++;
+            if (wide_won(b, i % 2, row, col)) {
+                wonWindows++;
+                break;
+            }
+        }
+        double t2 = now();
+        tScan += t1 - t0;
+        tWindows += t2 - t1;
+    }
+    free(b);
+    if (wonScan != wonWindows) {
+        fprintf(stderr, "mismatch: the scan saw %ld wins, the windows %ld\n", wonScan, wonWindows);
+        exit(EXIT_FAILURE);
+    }
+    *scan = moves / tScan;
+    *windows = moves / tWindows;
+}
+
+// ultimate games, one move is a small board and a cell in it; the longest possible game has 81
+#define ULT_MOVES_MAX 81
+
+struct ultgame {
+    unsigned char board[ULT_MOVES_MAX], cell[ULT_MOVES_MAX];
+    int moves;
+    int result; // 1 won, 0 drawn
+};
+
+// plays random legal moves until the game is decided, the engine picks which moves are legal
+void ult_record(struct ultgame *g){
+    struct ultimate u;
+    ult_clear(&u);
+    g->moves = 0;
+    for (;;) {
+        int legal[81], n = 0;
+        for (int i = 0; i < 81; i++) {
+            if (ult_legal(&u, i / 9, i % 9) == 0) legal[n++] = i;
+        }
+        int pick = legal[rand() % n], player = g->moves % 2;
+        g->board[g->moves] = pick / 9;
+        g->cell[g->moves] = pick % 9;
+        g->moves++;
+        if (ult_play(&u, player, pick / 9, pick % 9)) {
+            g->result = 1;
+            return;
+        }
+        if (ult_full(&u)) {
+            g->result = 0;
+            return;
+        }
+    }
+}
+
+// replays every recorded game, returns the moves per second
+double run_ultimate(void){
+    int rounds = ngames / 10 > 0 ? ngames / 10 : 1;
+    struct ultgame *recorded = malloc(sizeof(*recorded) * rounds);
+    long moves = 0, won = 0, wonRecorded = 0;
+
+    for (int g = 0; g < rounds; g++) {
+        ult_record(&recorded[g]);
+        wonRecorded += recorded[g].result;
+    }
+    double t0 = now();
+    for (int g = 0; g < rounds; g++) {
+        struct ultimate u;
+        ult_clear(&u);
+        for (int i = 0; i < recorded[g].moves; i++) {
+            if (ult_legal(&u, recorded[g].board[i], recorded[g].cell[i]) != 0) break;
+            moves++;
+            if (ult_play(&u, i % 2, recorded[g].board[i], recorded[g].cell[i])) {
+                won++;
+                break;
+            }
+            if (ult_full(&u)) break;
+        }
+    }
+    double t1 = now();
+    free(recorded);
+    if (won != wonRecorded) {
+        fprintf(stderr, "mismatch: %ld games won when recorded, %ld replayed\n", wonRecorded, won);
+        exit(EXIT_FAILURE);
+    }
+    printf("ultimate: %d games, %ld moves, %.1f ns per move\n", rounds, moves, (t1 - t0) / moves * 1e9);
+    return moves / (t1 - t0);
+}
+
+int main(int argc, char **argv){
+    ngames = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (ngames < 1) {
+        fprintf(stderr, "usage: %s [games]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    games = malloc(sizeof(*games) * ngames);
+    srand(1);
+    deal();
+    board_init();
+
+    long endedS = 0, endedB = 0;
+    double t0 = now();
+    long movesS = run_strings(&endedS);
+    double t1 = now();
+    long movesB = run_bitboards(&endedB);
+    double t2 = now();
+
+    // both must have judged every game the same way
+    if (movesS != movesB || endedS != endedB) {
+        fprintf(stderr, "mismatch: strings %ld moves %ld ended, bitboards %ld moves %ld ended\n",
+            movesS, endedS, movesB, endedB);
+        exit(EXIT_FAILURE);
+    }
+    printf("%d games, %ld moves\n", ngames, movesS);
+    printf("grid strings: %.1f M evaluations/s\n", movesS / (t1 - t0) / 1e6);
+    printf("bitboards:    %.1f M evaluations/s (%.1fx)\n", movesB / (t2 - t1) / 1e6, (t1 - t0) / (t2 - t1));
+
+    double scan, windows;
+    run_wide(&scan, &windows);
+    printf("%dx%d, %d in a row, full scan:    %.2f M evaluations/s\n", WIDE_SIDE, WIDE_SIDE, WIDE_RUN, scan / 1e6);
+    printf("%dx%d, %d in a row, move windows: %.2f M evaluations/s (%.0fx)\n", WIDE_SIDE, WIDE_SIDE, WIDE_RUN,
+        windows / 1e6, windows / scan);
+
+    printf("ultimate: %.1f M moves/s\n", run_ultimate() / 1e6);
+    free(games);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+// contention - drives games through a running ttts to measure how many moves per second it handles
+//     Arguments are host, port, number of games played at once and seconds to run
+//     Every game is one thread holding both players' connections: the players challenge each other
+//     by name, play the same nine moves to a full board and reconnect for the next game
+//     Run it against the threaded engine with -l 1 (one lock) and the default stripes to compare,
+//     raising the number of games: each one keeps two of the server's pool threads busy
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <string.h>
+#include <pthread.h>
+
+char *host, *service;
+int seconds;
+volatile int running = 1;
+
+// X and O alternate, no line is ever completed, the last move fills the board
+char *moves[] = { "1,1", "1,2", "1,3", "2,2", "2,1", "2,3", "3,2", "3,1", "3,3" };
+
+struct player {
+    int fd;
+    char buf[1024];
+    int len;
+};
+
+struct result {
+    long moves;
+    long games;
+    int failed;
+};
+
+int connect_inet(char *host, char *service){
+    struct addrinfo hints, *info_list, *info;
+    int sock = -1, error, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    error = getaddrinfo(host, service, &hints, &info_list);
+    if (error) {
+        fprintf(stderr, "error looking up %s:%s: %s\n", host, service, gai_strerror(error));
+        return -1;
+    }
+    for (info = info_list; info != NULL; info = info->ai_next) {
+        sock = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (sock < 0) continue;
+        if (connect(sock, info->ai_addr, info->ai_addrlen) == 0) break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(info_list);
+    if (sock != -1) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+int send_line(struct player *p, char *cmd, char *payload){
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s|%d|%s\n", cmd, (int)strlen(payload), payload);
+    return write(p->fd, line, n) == n ? 0 : -1;
+}
+
+// reads until the player has received a message starting with what, and drops everything up to its end
+// server messages are not newline terminated: a message ends at the pipe closing its last field
+int expect(struct player *p, char *what){
+    for (;;) {
+        char *at = strstr(p->buf, what);
+        if (at != NULL) {
+            char *end = strchr(at + strlen(what), '|'); // end of the length field
+            if (end != NULL) {
+                int length = atoi(at + strlen(what));
+                char *rest = end + 1;
+                if ((int)strlen(rest) >= length) {
+                    rest += length;
+                    p->len -= rest - p->buf;
+                    memmove(p->buf, rest, p->len + 1);
+                    return 0;
+                }
+            }
+        }
+        if (p->len >= (int)sizeof(p->buf) - 1) return -1;
+        ssize_t n = read(p->fd, p->buf + p->len, sizeof(p->buf) - 1 - p->len);
+        if (n <= 0) return -1;
+        p->len += n;
+        p->buf[p->len] = '\0';
+    }
+}
+
+// plays one game to a full board, returns the moves made or -1
+int play_game(int id, long game){
+    struct player x = { -1, "", 0 }, o = { -1, "", 0 };
+    char names[2][32], payload[80];
+    int made = -1;
+
+    snprintf(names[0], sizeof(names[0]), "x%d.%ld", id, game);
+    snprintf(names[1], sizeof(names[1]), "o%d.%ld", id, game);
+    x.fd = connect_inet(host, service);
+    o.fd = connect_inet(host, service);
+    if (x.fd == -1 || o.fd == -1) goto done;
+
+    // whoever waits first is X
+    snprintf(payload, sizeof(payload), "%s|%s|", names[0], names[1]);
+    if (send_line(&x, "PLAY", payload) || expect(&x, "WAIT|")) goto done;
+    snprintf(payload, sizeof(payload), "%s|%s|", names[1], names[0]);
+    if (send_line(&o, "PLAY", payload) || expect(&o, "WAIT|")) goto done;
+    if (expect(&x, "BEGN|") || expect(&o, "BEGN|")) goto done;
+
+    for (int i = 0; i < 9; i++) {
+        struct player *mover = i % 2 == 0 ? &x : &o;
+        snprintf(payload, sizeof(payload), "%c|%s|", i % 2 == 0 ? 'X' : 'O', moves[i]);
+        if (send_line(mover, "MOVE", payload)) goto done;
+        if (expect(&x, "MOVD|") || expect(&o, "MOVD|")) goto done;
+    }
+    if (expect(&x, "OVER|") || expect(&o, "OVER|")) goto done;
+    made = 9;
+
+done:
+    if (x.fd != -1) close(x.fd);
+    if (o.fd != -1) close(o.fd);
+    return made;
+}
+
+struct job {
+    int id;
+    struct result result;
+};
+
+void *worker(void *arg){
+    struct job *job = arg;
+    long game = 0;
+
+    while (running) {
+        int made = play_game(job->id, game++);
+        if (made < 0) {
+            job->result.failed++;
+            if (job->result.failed > 10) break;
+            continue;
+        }
+        job->result.moves += made;
+        job->result.games++;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv){
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s host port games seconds\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    host = argv[1];
+    service = argv[2];
+    int games = atoi(argv[3]);
+    seconds = atoi(argv[4]);
+    if (games < 1 || seconds < 1) {
+        fprintf(stderr, "games and seconds must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct job *jobs = calloc(games, sizeof(struct job));
+    pthread_t *tids = calloc(games, sizeof(pthread_t));
+    for (int i = 0; i < games; i++) {
+        jobs[i].id = i;
+        pthread_create(&tids[i], NULL, worker, &jobs[i]);
+    }
+    sleep(seconds);
+    running = 0;
+
+    long moves = 0, played = 0;
+    int failed = 0;
+    for (int i = 0; i < games; i++) {
+        pthread_join(tids[i], NULL);
+        moves += jobs[i].result.moves;
+        played += jobs[i].result.games;
+        failed += jobs[i].result.failed;
+    }
+    printf("%d games at once: %ld games, %.0f moves/s, %d failed\n",
+        games, played, (double)moves / seconds, failed);
+    free(jobs);
+    free(tids);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+// micro - microbenchmarks of the server's own routines, results as JSON on stdout
+//     Optional argument is the number of iterations of each benchmark (default 1000000)
+//     ttts.c is compiled into this file without its main(), so every routine is the server's own:
+//         frame/*   splitting a received line into fields and finding its command
+//         games/*   starting and ending a game, finding a connection by descriptor
+//         names/*   claiming and releasing names, and refusing one already taken
+//     Move judging has its own benchmark (boardbench), and so do the stripe locks (contention): lock
+//     contention only shows with games running on several cores, pair_lock() timed here would not measure it
+//     Every result is { name, iterations, ns_per_op }
+//     Run through make bench, which builds it optimized and without the sanitizers
+
+#define TTTS_NO_MAIN
+#include "../ttts.c"
+
+#define MICRO_PLAYERS 10000 // connections registered for the lookup benchmarks
+#define MICRO_FD_BASE 10000 // their made-up descriptors, never open: the players are corked, replies only queue
+
+long iterations = 1000000;
+volatile long sink; // keeps results alive
+int results;
+
+void result(const char *name, long ops, long long ns){
+    printf("%s    { \"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f }",
+        results++ ? ",\n" : "", name, ops, (double)ns / ops);
+}
+
+// a connection as session_open() leaves it, on no socket
+// corked for good, so out_queue() appends replies instead of trying send() on a descriptor that is not open
+struct connection_data *fake_player(int fd, const char *name){
+    struct connection_data *con = obj_calloc(POOL_CONN);
+    con->fd = fd;
+    con->nameSize = snprintf(con->name, sizeof(con->name), "%s", name);
+    con->variant = VARIANT_STANDARD;
+    con->corked = 1;
+    pthread_mutex_init(&con->outLock, NULL);
+    shard_attach(con);
+    con->yourFd->con = con;
+    return con;
+}
+
+void bench_frame(void){
+    const char *lines[] = { "MOVE|6|X|2,2|\n", "PLAY|12|challenger|\n" };
+    const char *names[] = { "frame/turnToRL_move", "frame/turnToRL_play" };
+    struct readList fields[MAX_FIELDS];
+    char buffer[LINE_CAP];
+
+    for (int l = 0; l < 2; l++) {
+        int len = strlen(lines[l]);
+        long long t0 = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            memcpy(buffer, lines[l], len); // turnToRL() writes into the line
+            sink += turnToRL(len, buffer, fields)->next->size;
+        }
+        result(names[l], iterations, now_ns() - t0);
+    }
+
+    // what handle_line() does ahead of the handler: split, check the length field, find the command
+    int len = strlen(lines[0]);
+    long long t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        memcpy(buffer, lines[0], len);
+        struct readList *list = turnToRL(len, buffer, fields);
+        if (isNumber(list->next->data)) sink += atoi(list->next->data);
+        sink += command_find(list->data, list->size) - commands;
+    }
+    result("frame/header_and_command", iterations, now_ns() - t0);
+}
+
+void bench_games(struct connection_data **players){
+    // the two players' stripe locks, the game linked in and BEGN queued to both; then ended and freed
+    long long t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        struct connection_data *one = players[(i * 2) % MICRO_PLAYERS], *two = players[(i * 2 + 1) % MICRO_PLAYERS];
+        pair_lock(one->fd, two->fd);
+        insertGame(one, two);
+        pair_unlock(one->fd, two->fd);
+        pair_lock(one->fd, two->fd);
+        deleteGame(one->game);
+        pair_unlock(one->fd, two->fd);
+        game_release(one);
+        game_release(two);
+        one->outLen = two->outLen = 0; // the BEGNs, so the queues never reach OUT_LIMIT
+    }
+    result("games/insert_delete", iterations, now_ns() - t0);
+
+    unsigned seed = 1;
+    t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        int fd = MICRO_FD_BASE + rand_r(&seed) % MICRO_PLAYERS;
+        sink += searchFileList(fd)->fileDescriptor;
+    }
+    result("games/search_fd", iterations, now_ns() - t0);
+}
+
+void bench_names(struct connection_data **players){
+    struct connection_data *newcomer = players[0];
+    char saved[51];
+    int savedSize = newcomer->nameSize;
+
+    memcpy(saved, newcomer->name, sizeof(saved));
+    // every player but the first holds its name, the first one claims fresh ones and gives them back
+    for (int i = 1; i < MICRO_PLAYERS; i++) names_claim(players[i]);
+    long long t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        newcomer->nameSize = snprintf(newcomer->name, sizeof(newcomer->name), "fresh%ld", i);
+        sink += names_claim(newcomer);
+        names_release(newcomer);
+    }
+    result("names/claim_release", iterations, now_ns() - t0);
+
+    t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        struct connection_data *taken = players[1 + i % (MICRO_PLAYERS - 1)];
+        newcomer->nameSize = taken->nameSize;
+        memcpy(newcomer->name, taken->name, taken->nameSize + 1);
+        sink += names_claim(newcomer); // refused, the name is in use
+    }
+    result("names/duplicate", iterations, now_ns() - t0);
+
+    for (int i = 1; i < MICRO_PLAYERS; i++) names_release(players[i]);
+    newcomer->nameSize = savedSize;
+    memcpy(newcomer->name, saved, sizeof(saved));
+}
+
+int main(int argc, char **argv){
+    struct rlimit limit;
+    struct connection_data **players;
+    char name[32];
+
+    if (argc > 1) iterations = atol(argv[1]);
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // so the descriptor table covers the made-up descriptors, like a server allowed that many connections
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < MICRO_FD_BASE + MICRO_PLAYERS) {
+        limit.rlim_cur = limit.rlim_max < FD_TABLE_MAX ? limit.rlim_max : FD_TABLE_MAX;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    logLevel = LOG_ERROR;
+    pools_init();
+    board_init();
+    replies_init();
+    commands_init();
+    names_init();
+    shards = calloc(1, sizeof(struct shard));
+    if (shard_init(&shards[0], 0) == -1) exit(EXIT_FAILURE);
+    shard = &shards[0];
+    players = malloc(sizeof(*players) * MICRO_PLAYERS);
+    for (int i = 0; i < MICRO_PLAYERS; i++) {
+        snprintf(name, sizeof(name), "player%d", i);
+        players[i] = fake_player(MICRO_FD_BASE + i, name);
+    }
+
+    printf("{\n  \"suite\": \"ttts micro\",\n  \"results\": [\n");
+    bench_frame();
+    bench_games(players);
+    bench_names(players);
+    printf("\n  ]\n}\n");
+
+    for (int i = 0; i < MICRO_PLAYERS; i++) {
+        deleteFd(players[i]->fd);
+        out_free(players[i]);
+        obj_free(POOL_CONN, players[i]);
+    }
+    free(players);
+    cleanup_games();
+    cleanup_fds();
+    shard_free();
+    free(shards);
+    names_free();
+    stats_free();
+    pools_flush();
+    pools_free();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,471 @@
+// swarm - load generator: thousands of bots playing whole games against a running ttts
+//     Arguments are host and port, options:
+//         -c bots (default 1000), -d seconds to run (10), -t threads (1), -m random|script moves,
+//         -D, -R, -Q percent of games in which X offers a draw, resigns or disconnects (10 each)
+//     Every bot is one non-blocking connection: it sends PLAY, plays its game to the end, then
+//     reconnects under a new name; each thread drives its share of the bots through its own epoll loop
+//     X decides how its game ends: a draw offer (the opponent accepts half of them), resigning or
+//     disconnecting happens at a random turn, every other game is played out; random moves pick any
+//     empty cell, scripted ones fill the board in the order bench/contention.c uses, a draw every time
+//     Prints games/s, how they ended, and percentiles of the time to match and of move round trips
+//     Only plays the standard 3x3 game
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#define BOT_BUF 512
+#define MAX_EVENTS 256
+#define IDLE_MS 100 // how often bots whose connect failed try again
+
+#define BOT_IDLE 0       // no connection, reconnects on the next sweep
+#define BOT_CONNECTING 1 // waiting for the non-blocking connect
+#define BOT_MATCHING 2   // PLAY sent, waiting for BEGN
+#define BOT_PLAYING 3
+
+// how X ends its game
+#define PLAN_PLAY 0 // plays it out
+#define PLAN_DRAW 1
+#define PLAN_RESIGN 2
+#define PLAN_QUIT 3 // disconnects
+#define PLANS 4
+
+// latency histogram, laid out like the server's: exact below 32 ns, then 16 buckets per power of two
+#define HDR_SUB_BITS 4
+#define HDR_SUB (1 << HDR_SUB_BITS)
+#define HDR_MAX_BIT 34
+#define HDR_BUCKETS ((HDR_MAX_BIT - HDR_SUB_BITS + 2) * HDR_SUB)
+
+struct hdr {
+    long counts[HDR_BUCKETS];
+    long samples;
+};
+
+struct tally {
+    long games[PLANS]; // counted by X, by how they ended
+    long moves;
+    long invalid; // INVL replies, the bots only send legal messages
+    long lost;    // connections closed by the server before OVER
+    long refused; // connects that failed
+    struct hdr match; // from PLAY to BEGN
+    struct hdr move;  // from MOVE to its MOVD
+};
+
+struct loop;
+
+struct bot {
+    struct loop *loop;
+    int id;
+    int fd;
+    int state;
+    long gen; // games started, part of the name
+    char buf[BOT_BUF];
+    int len;
+    char role;
+    char board[9];
+    int myTurn;
+    int turns;    // moves made this game
+    int plan;     // X only
+    int planTurn; // the move it acts on instead
+    int acted;    // the plan was carried out
+    long long sentAt; // PLAY or MOVE
+};
+
+struct loop {
+    int id;
+    int epfd;
+    struct bot *bots;
+    int nbots;
+    int idle; // bots waiting to reconnect
+    unsigned seed;
+    struct tally tally;
+    pthread_t tid;
+};
+
+struct sockaddr_storage addr;
+socklen_t addrLen;
+int scripted;
+int odds[PLANS]; // percent of games, odds[PLAN_PLAY] unused
+volatile int running = 1;
+
+char *script[] = { "1,1", "1,2", "1,3", "2,2", "2,1", "2,3", "3,2", "3,1", "3,3" };
+char *planNames[PLANS] = { "played out", "with a draw offer", "resigned", "abandoned" };
+
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int hdr_bucket(long long ns){
+    if (ns < 2 * HDR_SUB) return ns < 0 ? 0 : ns;
+    int top = 63 - __builtin_clzll(ns);
+    if (top > HDR_MAX_BIT) return HDR_BUCKETS - 1;
+    int shift = top - HDR_SUB_BITS;
+    return HDR_SUB * (shift + 1) + (ns >> shift) - HDR_SUB;
+}
+
+// the largest value bucket i holds
+long long hdr_top(int i){
+    if (i < 2 * HDR_SUB) return i;
+    int shift = i / HDR_SUB - 1;
+    return ((long long)(i % HDR_SUB + HDR_SUB) << shift) + (1LL << shift) - 1;
+}
+
+void hdr_add(struct hdr *h, long long ns){
+    h->counts[hdr_bucket(ns)]++;
+    h->samples++;
+}
+
+long long hdr_permille(struct hdr *h, long permille){
+    long want = (h->samples * permille + 999) / 1000, seen = 0;
+    for (int i = 0; i < HDR_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want && seen > 0) return hdr_top(i);
+    }
+    return 0;
+}
+
+void hdr_print(const char *title, struct hdr *h){
+    if (h->samples == 0) return;
+    printf("%s: %ld samples, p50 %.1f us, p99 %.1f us, p999 %.1f us\n", title, h->samples,
+        hdr_permille(h, 500) / 1e3, hdr_permille(h, 990) / 1e3, hdr_permille(h, 999) / 1e3);
+}
+
+int resolve(char *host, char *service){
+    struct addrinfo hints, *info;
+    int error;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, service, &hints, &info);
+    if (error) {
+        fprintf(stderr, "error looking up %s:%s: %s\n", host, service, gai_strerror(error));
+        return -1;
+    }
+    memcpy(&addr, info->ai_addr, info->ai_addrlen);
+    addrLen = info->ai_addrlen;
+    freeaddrinfo(info);
+    return 0;
+}
+
+void bot_close(struct bot *b){
+    if (b->fd != -1) close(b->fd); // closing also drops it from the epoll set
+    b->fd = -1;
+    b->state = BOT_IDLE;
+    b->loop->idle++;
+}
+
+// starts a connect, the bot moves on once the socket turns writable
+void bot_connect(struct bot *b){
+    struct epoll_event ev;
+    int one = 1;
+
+    b->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (b->fd == -1) {
+        b->loop->tally.refused++;
+        return;
+    }
+    setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(b->fd, (struct sockaddr *)&addr, addrLen) == -1 && errno != EINPROGRESS) {
+        b->loop->tally.refused++;
+        close(b->fd);
+        b->fd = -1;
+        return;
+    }
+    ev.events = EPOLLOUT;
+    ev.data.ptr = b;
+    epoll_ctl(b->loop->epfd, EPOLL_CTL_ADD, b->fd, &ev);
+    b->state = BOT_CONNECTING;
+    b->len = 0;
+    b->loop->idle--;
+}
+
+// the game is over for this bot: a new connection plays the next one
+void bot_restart(struct bot *b){
+    bot_close(b);
+    if (running) bot_connect(b);
+}
+
+// messages are tiny, a socket without room for one counts as lost
+int bot_send(struct bot *b, char *cmd, char *payload){
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s|%d|%s\n", cmd, (int)strlen(payload), payload);
+    if (send(b->fd, line, n, MSG_NOSIGNAL) == n) return 0;
+    b->loop->tally.lost++;
+    bot_restart(b);
+    return -1;
+}
+
+void bot_play(struct bot *b){
+    char name[32], payload[40];
+
+    snprintf(name, sizeof(name), "b%d.%d.%ld", b->loop->id, b->id, b->gen++);
+    snprintf(payload, sizeof(payload), "%s|", name);
+    b->state = BOT_MATCHING;
+    b->sentAt = now_ns();
+    bot_send(b, "PLAY", payload);
+}
+
+// X picks how this game ends
+void bot_plan(struct bot *b){
+    int roll = rand_r(&b->loop->seed) % 100;
+
+    b->plan = PLAN_PLAY;
+    b->acted = 0;
+    for (int p = PLAN_DRAW; p < PLANS; p++) {
+        if (roll < odds[p]) {
+            b->plan = p;
+            break;
+        }
+        roll -= odds[p];
+    }
+    b->planTurn = rand_r(&b->loop->seed) % 4; // X makes at least four moves unless someone wins
+}
+
+// the bot's turn: carries out X's plan when its turn has come, otherwise moves
+void bot_move(struct bot *b){
+    char payload[24];
+    int cells[9], n = 0;
+
+    b->myTurn = 0;
+    if (b->role == 'X' && b->plan != PLAN_PLAY && !b->acted && b->turns == b->planTurn) {
+        b->acted = 1;
+        if (b->plan == PLAN_DRAW) {
+            bot_send(b, "DRAW", "S|");
+        } else if (b->plan == PLAN_RESIGN) {
+            bot_send(b, "RSGN", "");
+        } else {
+            b->loop->tally.games[PLAN_QUIT]++;
+            bot_restart(b);
+        }
+        return;
+    }
+
+    for (int i = 0; i < 9; i++) {
+        int cell = scripted ? (script[i][0] - '1') * 3 + script[i][2] - '1' : i;
+        if (b->board[cell] == '.') cells[n++] = cell;
+    }
+    if (n == 0) return; // the board is full, OVER is on its way
+    int cell = scripted ? cells[0] : cells[rand_r(&b->loop->seed) % n];
+    snprintf(payload, sizeof(payload), "%c|%d,%d|", b->role, cell / 3 + 1, cell % 3 + 1);
+    b->turns++;
+    b->sentAt = now_ns();
+    bot_send(b, "MOVE", payload);
+}
+
+// acts on one message from the server, returns -1 once the bot's connection is gone
+int bot_message(struct bot *b, char *code, char *payload, int size){
+    struct tally *t = &b->loop->tally;
+
+    if (strncmp(code, "BEGN", 4) == 0 && size > 0) {
+        hdr_add(&t->match, now_ns() - b->sentAt);
+        b->state = BOT_PLAYING;
+        b->role = payload[0];
+        memset(b->board, '.', sizeof(b->board));
+        b->turns = 0;
+        b->myTurn = b->role == 'X';
+        if (b->role == 'X') bot_plan(b);
+    } else if (strncmp(code, "MOVD", 4) == 0 && size >= 5) {
+        b->board[(payload[2] - '1') * 3 + payload[4] - '1'] = payload[0];
+        if (payload[0] == b->role) {
+            hdr_add(&t->move, now_ns() - b->sentAt);
+            t->moves++;
+        } else {
+            b->myTurn = 1;
+        }
+    } else if (strncmp(code, "DRAW", 4) == 0 && size > 0) {
+        if (payload[0] == 'S') { // offered to us
+            return bot_send(b, "DRAW", rand_r(&b->loop->seed) % 2 ? "A|" : "R|");
+        }
+        b->myTurn = 1; // ours was rejected, keep playing
+    } else if (strncmp(code, "OVER", 4) == 0) {
+        if (b->role == 'X') t->games[b->acted ? b->plan : PLAN_PLAY]++;
+        bot_restart(b);
+        return -1;
+    } else if (strncmp(code, "INVL", 4) == 0) {
+        t->invalid++;
+        bot_restart(b);
+        return -1;
+    }
+    return 0;
+}
+
+// handles every complete message in the buffer, "CODE|length|" and length bytes each
+// returns -1 once the bot's connection is gone
+int bot_messages(struct bot *b){
+    int off = 0;
+
+    while (b->len - off >= 7) {
+        char *msg = b->buf + off;
+        char *bar = memchr(msg + 5, '|', b->len - off - 5);
+        if (bar == NULL) break;
+        int head = bar - msg + 1, size = atoi(msg + 5);
+        if (b->len - off < head + size) break;
+        if (bot_message(b, msg, msg + head, size) == -1) return -1;
+        off += head + size;
+    }
+    b->len -= off;
+    memmove(b->buf, b->buf + off, b->len);
+    if (b->len == BOT_BUF) { // not a message we understand
+        b->loop->tally.lost++;
+        bot_restart(b);
+        return -1;
+    }
+    return 0;
+}
+
+void bot_event(struct bot *b, unsigned events){
+    struct epoll_event ev;
+
+    if (b->state == BOT_CONNECTING) {
+        int error = 0;
+        socklen_t size = sizeof(error);
+        getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &error, &size);
+        if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            b->loop->tally.refused++;
+            bot_close(b);
+            return;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = b;
+        epoll_ctl(b->loop->epfd, EPOLL_CTL_MOD, b->fd, &ev);
+        bot_play(b);
+        return;
+    }
+
+    ssize_t n = recv(b->fd, b->buf + b->len, BOT_BUF - b->len, 0);
+    if (n <= 0) {
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) return;
+        b->loop->tally.lost++;
+        bot_restart(b);
+        return;
+    }
+    b->len += n;
+    // a move is made only once everything that arrived is read: OVER may follow the opponent's MOVD
+    if (bot_messages(b) == 0 && b->state == BOT_PLAYING && b->myTurn) bot_move(b);
+}
+
+void *loop_run(void *arg){
+    struct loop *l = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    l->epfd = epoll_create1(0);
+    for (int i = 0; i < l->nbots; i++) bot_connect(&l->bots[i]);
+    while (running) {
+        int n = epoll_wait(l->epfd, events, MAX_EVENTS, IDLE_MS);
+        for (int i = 0; i < n; i++) bot_event(events[i].data.ptr, events[i].events);
+        for (int i = 0; l->idle > 0 && running && i < l->nbots; i++) {
+            if (l->bots[i].state == BOT_IDLE) bot_connect(&l->bots[i]);
+        }
+    }
+    for (int i = 0; i < l->nbots; i++) {
+        if (l->bots[i].fd != -1) close(l->bots[i].fd);
+    }
+    close(l->epfd);
+    return NULL;
+}
+
+void usage(char *prog){
+    fprintf(stderr, "usage: %s [-c bots] [-d seconds] [-t threads] [-m random|script] [-D draw %%] [-R resign %%] [-Q quit %%] host port\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv){
+    int nbots = 1000, seconds = 10, nthreads = 1, opt;
+    struct rlimit limit;
+
+    odds[PLAN_DRAW] = odds[PLAN_RESIGN] = odds[PLAN_QUIT] = 10;
+    while ((opt = getopt(argc, argv, "c:d:t:m:D:R:Q:")) != -1) {
+        switch (opt) {
+        case 'c': nbots = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'm':
+            if (strcmp(optarg, "script") == 0) scripted = 1;
+            else if (strcmp(optarg, "random") != 0) usage(argv[0]);
+            break;
+        case 'D': odds[PLAN_DRAW] = atoi(optarg); break;
+        case 'R': odds[PLAN_RESIGN] = atoi(optarg); break;
+        case 'Q': odds[PLAN_QUIT] = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || nbots < 2 || seconds < 1 || nthreads < 1 || nthreads > nbots) usage(argv[0]);
+    if (odds[PLAN_DRAW] < 0 || odds[PLAN_RESIGN] < 0 || odds[PLAN_QUIT] < 0
+            || odds[PLAN_DRAW] + odds[PLAN_RESIGN] + odds[PLAN_QUIT] > 100) {
+        fprintf(stderr, "-D, -R and -Q are percentages adding up to at most 100\n");
+        exit(EXIT_FAILURE);
+    }
+    if (resolve(argv[optind], argv[optind + 1]) == -1) exit(EXIT_FAILURE);
+
+    // a descriptor per bot
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    struct loop *loops = calloc(nthreads, sizeof(struct loop));
+    struct bot *bots = calloc(nbots, sizeof(struct bot));
+    for (int i = 0, first = 0; i < nthreads; i++) {
+        struct loop *l = &loops[i];
+        l->id = i;
+        l->seed = i + 1;
+        l->bots = bots + first;
+        l->nbots = nbots / nthreads + (i < nbots % nthreads);
+        for (int j = 0; j < l->nbots; j++) {
+            l->bots[j].loop = l;
+            l->bots[j].id = j;
+            l->bots[j].fd = -1;
+        }
+        l->idle = l->nbots;
+        first += l->nbots;
+        pthread_create(&l->tid, NULL, loop_run, l);
+    }
+    sleep(seconds);
+    running = 0;
+
+    struct tally *all = calloc(1, sizeof(struct tally));
+    long games = 0;
+    for (int i = 0; i < nthreads; i++) {
+        struct tally *t = &loops[i].tally;
+        pthread_join(loops[i].tid, NULL);
+        for (int p = 0; p < PLANS; p++) all->games[p] += t->games[p];
+        all->moves += t->moves;
+        all->invalid += t->invalid;
+        all->lost += t->lost;
+        all->refused += t->refused;
+        for (int b = 0; b < HDR_BUCKETS; b++) {
+            all->match.counts[b] += t->match.counts[b];
+            all->move.counts[b] += t->move.counts[b];
+        }
+        all->match.samples += t->match.samples;
+        all->move.samples += t->move.samples;
+    }
+    for (int p = 0; p < PLANS; p++) games += all->games[p];
+
+    printf("%d bots on %d threads for %d s: %ld games, %.1f games/s, %.0f moves/s\n",
+        nbots, nthreads, seconds, games, (double)games / seconds, (double)all->moves / seconds);
+    for (int p = 0; p < PLANS; p++) printf("  %s: %ld\n", planNames[p], all->games[p]);
+    hdr_print("time to match", &all->match);
+    hdr_print("move round trip", &all->move);
+    printf("errors: %ld INVL, %ld connections lost, %ld connects failed\n", all->invalid, all->lost, all->refused);
+
+    int failed = all->invalid > 0 || all->lost > 0;
+    free(all);
+    free(bots);
+    free(loops);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+// board - tic-tac-toe rules on bitboards, the -b N×N boards and ultimate tic-tac-toe, see board.h
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "board.h"
+
+// the eight lines: rows, columns, diagonals
+static const unsigned short lines[8] = {
+    0007, 0070, 0700,  // rows
+    0111, 0222, 0444,  // columns
+    0421, 0124         // diagonals
+};
+
+static unsigned char wins[1 << BOARD_CELLS]; // 1 for every mask holding a whole line
+static char glyphs[4] = { '.', 'X', 'O', '?' }; // by (X bit) | (O bit) << 1
+static unsigned char ultBoard[81], ultCell[81]; // ultimate: where 9 * (r - 1) + (c - 1) falls
+
+void board_init(void){
+    for (int mask = 0; mask < (1 << BOARD_CELLS); mask++) {
+        wins[mask] = 0;
+        for (int i = 0; i < 8; i++) {
+            if ((mask & lines[i]) == lines[i]) wins[mask] = 1;
+        }
+    }
+    for (int i = 0; i < 81; i++) {
+        int row = i / 9, col = i % 9;
+        ultBoard[i] = row / 3 * 3 + col / 3;
+        ultCell[i] = row % 3 * 3 + col % 3;
+    }
+}
+
+int board_cell(const char *coords, int size){
+    if (size != 3 || coords[1] != ',') return -1;
+    unsigned row = coords[0] - '1', col = coords[2] - '1'; // anything outside '1'..'3' wraps past 2
+    if (row > 2 || col > 2) return -1;
+    return row * 3 + col;
+}
+
+int board_play(struct board *b, int player, int cell){
+    unsigned short bit = 1 << cell;
+    if ((b->marks[0] | b->marks[1]) & bit) return -1;
+    b->marks[player] |= bit;
+    return 0;
+}
+
+int board_won(const struct board *b, int player){
+    return wins[b->marks[player]];
+}
+
+int board_full(const struct board *b){
+    return (b->marks[0] | b->marks[1]) == BOARD_FULL;
+}
+
+void board_render(const struct board *b, char *grid){
+    for (int i = 0; i < BOARD_CELLS; i++) {
+        grid[i] = glyphs[((b->marks[0] >> i) & 1) | ((b->marks[1] >> i) & 1) << 1];
+    }
+    grid[BOARD_CELLS] = '\0';
+}
+
+static int side = 3, need = 3; // -b: the wide boards' side and winning length
+
+int wide_setup(int size, int k){
+    if (size < 3 || size > WIDE_MAX || k < 3 || k > size || k > WIDE_K_MAX) return -1;
+    side = size;
+    need = k;
+    return 0;
+}
+
+int wide_bytes(void){
+    return sizeof(struct wideboard) + (6 * side - 2) * WIDE_SLOT;
+}
+
+void wide_clear(struct wideboard *b){
+    memset(b, 0, wide_bytes());
+}
+
+int wide_cell(const char *coords, int size, int *row, int *col){
+    int at = 0, values[2];
+
+    for (int i = 0; i < 2; i++) {
+        int digits = 0, value = 0;
+        while (at < size && coords[at] >= '0' && coords[at] <= '9' && digits < 2) {
+            value = value * 10 + coords[at++] - '0';
+            digits++;
+        }
+        if (digits == 0 || value < 1 || value > side) return -1;
+        if (i == 0 && (at >= size || coords[at++] != ',')) return -1;
+        values[i] = value - 1;
+    }
+    if (at != size) return -1;
+    *row = values[0];
+    *col = values[1];
+    return 0;
+}
+
+// where row, col sits in each of the four lines through it: the slot's offset, plus the cell's
+// position in it; diagonals are indexed by column too, cells they do not reach stay empty
+static void wide_places(int row, int col, int *at){
+    at[0] = row * WIDE_SLOT + 16 + col;                                    // its row
+    at[1] = (side + col) * WIDE_SLOT + 16 + row;                           // its column
+    at[2] = (2 * side + row - col + side - 1) * WIDE_SLOT + 16 + col;      // down-right diagonal
+    at[3] = (4 * side - 1 + row + col) * WIDE_SLOT + 16 + col;             // down-left diagonal
+}
+
+int wide_play(struct wideboard *b, int player, int row, int col){
+    int at[4];
+
+    wide_places(row, col, at);
+    if (b->lines[at[0]] != 0) return -1;
+    for (int i = 0; i < 4; i++) b->lines[at[i]] = player + 1;
+    b->moves++;
+    return 0;
+}
+
+// bit i set if the i-th of the 16 cells starting at cells holds mark
+static unsigned window_mask(const unsigned char *cells, unsigned char mark){
+#ifdef __SSE2__
+    __m128i window = _mm_loadu_si128((const __m128i *)cells);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(window, _mm_set1_epi8(mark)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < 16; i++) mask |= (unsigned)(cells[i] == mark) << i;
+    return mask;
+#endif
+}
+
+int wide_won(const struct wideboard *b, int player, int row, int col){
+    int at[4];
+
+    wide_places(row, col, at);
+    for (int i = 0; i < 4; i++) {
+        // the window starts k-1 cells before the move: k in a row inside it go through the move,
+        // or were there before it and would have ended the game
+        unsigned run = window_mask(b->lines + at[i] - (need - 1), player + 1);
+        for (int j = 1; j < need && run != 0; j++) run &= run >> 1;
+        if (run != 0) return 1;
+    }
+    return 0;
+}
+
+int wide_full(const struct wideboard *b){
+    return b->moves == side * side;
+}
+
+void ult_clear(struct ultimate *u){
+    memset(u, 0, sizeof(*u));
+    u->next = ULT_ANY;
+}
+
+int ult_cell(const char *coords, int size, int *board, int *cell){
+    if (size != 3 || coords[1] != ',') return -1;
+    unsigned row = coords[0] - '1', col = coords[2] - '1';
+    if (row > 8 || col > 8) return -1;
+    *board = ultBoard[row * 9 + col];
+    *cell = ultCell[row * 9 + col];
+    return 0;
+}
+
+int ult_legal(const struct ultimate *u, int board, int cell){
+    unsigned short open = u->next == ULT_ANY ? ~u->closed & BOARD_FULL : 1 << u->next;
+    if (!(open & (1 << board))) return ULT_ELSEWHERE;
+    if ((u->cells[0][board] | u->cells[1][board]) & (1 << cell)) return ULT_TAKEN;
+    return 0;
+}
+
+int ult_play(struct ultimate *u, int player, int board, int cell){
+    unsigned short *small = &u->cells[player][board];
+
+    *small |= 1 << cell;
+    if (wins[*small]) {
+        u->won[player] |= 1 << board;
+        u->closed |= 1 << board;
+    } else if ((u->cells[0][board] | u->cells[1][board]) == BOARD_FULL) {
+        u->closed |= 1 << board;
+    }
+    u->next = u->closed & (1 << cell) ? ULT_ANY : cell;
+    return wins[u->won[player]];
+}
+
+int ult_full(const struct ultimate *u){
+    return u->closed == BOARD_FULL;
+}
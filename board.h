@@ -0,0 +1,97 @@
+// board - tic-tac-toe rules on bitboards, wider boards for -b, and ultimate tic-tac-toe
+//     Each player's marks are a 9-bit mask, cell r,c is bit 3 * (r - 1) + (c - 1)
+//     A move, a win and a full board are each a mask operation and at most one table lookup
+//     The textual grid is only built when a reply needs it
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#define BOARD_CELLS 9
+#define BOARD_FULL 0x1ff // every cell taken
+
+struct board {
+    unsigned short marks[2]; // X's cells, then O's
+};
+
+// fills the lookup tables, call once before any other board function
+void board_init(void);
+
+// the cell named by "r,c" with r and c between 1 and 3, -1 for anything else
+int board_cell(const char *coords, int size);
+
+// marks cell for player (0 is X, 1 is O), returns -1 if the cell is taken
+int board_play(struct board *b, int player, int cell);
+
+// 1 if player has three in a row
+int board_won(const struct board *b, int player);
+
+// 1 once every cell is taken
+int board_full(const struct board *b);
+
+// writes the grid as 9 characters ('X', 'O' or '.') and a terminating '\0'
+void board_render(const struct board *b, char *grid);
+
+// N×N boards where k marks in a row win (15,5 is gomoku), picked for the whole server with -b
+//     Every line through the board is stored on its own: rows, columns, diagonals and antidiagonals,
+//     each in a WIDE_SLOT-byte slot with room on both sides, so the 2k-1 cells around any move in any
+//     direction are one unaligned 16-byte load; a win is a compare and a run of k set bits
+#define WIDE_MAX 19   // largest side, coordinates are one or two digits
+#define WIDE_K_MAX 8  // 2k-1 cells have to fit in 16 bytes
+#define WIDE_SLOT 48  // 16 bytes of padding, up to 19 cells, padding for a window starting at the last one
+
+struct wideboard {
+    int moves;
+    unsigned char lines[]; // 6N-2 slots; 0 is empty, 1 is X, 2 is O
+};
+
+// sets the side and the winning length for every wide board, -1 if they are out of range
+int wide_setup(int size, int k);
+
+// bytes of a wide board for the current setup
+int wide_bytes(void);
+
+void wide_clear(struct wideboard *b);
+
+// parses "r,c" with both between 1 and the side into a 0-based row and column, -1 if invalid
+int wide_cell(const char *coords, int size, int *row, int *col);
+
+// marks row, col for player (0 is X, 1 is O), returns -1 if the cell is taken
+int wide_play(struct wideboard *b, int player, int row, int col);
+
+// 1 if the move player just made at row, col completed k in a row, only the lines through it are looked at
+int wide_won(const struct wideboard *b, int player, int row, int col);
+
+int wide_full(const struct wideboard *b);
+
+// ultimate tic-tac-toe: nine small boards in a 3×3 grid, picked per game in PLAY
+//     Cell r,c (1 to 9 each) is cell (r-1)%3*3 + (c-1)%3 of small board (r-1)/3*3 + (c-1)/3
+//     A move sends the opponent to the small board matching the cell it took, unless that board is
+//     closed (won or full), then any open board will do; three small boards in a row win
+//     Every small board and the meta board are 9-bit masks, so the legal boards are one mask and
+//     a move, a small win and the game win are each one lookup in the same table as the 3×3 game
+#define ULT_ANY -1       // the next move may go in any open small board
+#define ULT_TAKEN -1     // ult_legal: the cell is taken
+#define ULT_ELSEWHERE -2 // ult_legal: the move is not in the small board the player was sent to
+
+struct ultimate {
+    unsigned short cells[2][BOARD_CELLS]; // per player, their marks in each small board
+    unsigned short won[2];                // per player, the small boards they won
+    unsigned short closed;                // small boards won or full
+    short next;                           // the small board to play in, or ULT_ANY
+};
+
+void ult_clear(struct ultimate *u);
+
+// parses "r,c" with both between 1 and 9 into a small board and a cell in it, -1 if invalid
+int ult_cell(const char *coords, int size, int *board, int *cell);
+
+// 0 if player may take cell in board, else ULT_TAKEN or ULT_ELSEWHERE
+int ult_legal(const struct ultimate *u, int board, int cell);
+
+// marks a legal move for player (0 is X, 1 is O), returns 1 if it won the game
+int ult_play(struct ultimate *u, int player, int board, int cell);
+
+// 1 once every small board is closed without a winner
+int ult_full(const struct ultimate *u);
+
+#endif
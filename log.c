@@ -0,0 +1,223 @@
+// log - per-thread rings and the writer thread draining them, see log.h
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+
+#define LOG_RING 256            // lines a thread may have queued, must be a power of 2
+#define LOG_TEXT 160            // longest line, longer ones are cut
+#define LOG_RATE 1000           // lines a thread may log per second, errors are never dropped by it
+#define LOG_IDLE_NS 10000000L   // the writer sleeps this long once every ring is empty (10 ms)
+#define LOG_BATCH 65536         // bytes the writer collects before each write
+
+struct logrec {
+    long long ns; // when it was logged, CLOCK_REALTIME
+    int level;
+    int len;
+    char text[LOG_TEXT];
+};
+
+// single producer (its thread), single consumer (the writer)
+struct logring {
+    struct logrec recs[LOG_RING];
+    unsigned head;      // next record to write out, moved by the writer
+    unsigned tail;      // next free record, moved by the owner
+    long dropped;       // lines lost since the writer last reported them
+    long long window;   // rate limit: start of the current second, owner only
+    int windowLines;    // lines logged in it, owner only
+    int id;
+    struct logring *next;
+    struct logring *spare; // next released ring, see log_release()
+};
+
+int logLevel = LOG_INFO;
+
+static const char *levels[] = { "error", "warn", "info", "debug" };
+static struct logring *rings; // every thread that logged, newest first; freed by log_stop()
+static int nrings;
+static struct logring *spare; // rings of threads that exited, reused before allocating
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct logring *mine;
+static pthread_t writer;
+static int running;
+static volatile sig_atomic_t dumpWanted;
+static void (*dumper)(void);
+
+static long long log_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct logring *log_ring(void){
+    if (mine != NULL) return mine;
+    pthread_mutex_lock(&ringsLock);
+    if (spare != NULL) {
+        mine = spare;
+        spare = spare->spare;
+        pthread_mutex_unlock(&ringsLock);
+        return mine;
+    }
+    pthread_mutex_unlock(&ringsLock);
+
+    mine = calloc(1, sizeof(struct logring));
+    if (mine == NULL) return NULL;
+    pthread_mutex_lock(&ringsLock);
+    mine->id = nrings++;
+    mine->next = rings;
+    rings = mine;
+    pthread_mutex_unlock(&ringsLock);
+    return mine;
+}
+
+void log_line(int level, const char *fmt, ...){
+    va_list ap;
+    long long now = log_now();
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) { // before log_start() or after log_stop()
+        va_start(ap, fmt);
+        flockfile(stdout);
+        printf("t=%lld.%06lld level=%s ", now / 1000000000, now % 1000000000 / 1000, levels[level]);
+        vprintf(fmt, ap);
+        putchar('\n');
+        funlockfile(stdout);
+        va_end(ap);
+        return;
+    }
+
+    struct logring *r = log_ring();
+    if (r == NULL) return;
+    if (now - r->window >= 1000000000) {
+        r->window = now;
+        r->windowLines = 0;
+    }
+    unsigned tail = r->tail;
+    if ((level != LOG_ERROR && ++r->windowLines > LOG_RATE)
+            || tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == LOG_RING) {
+        __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct logrec *rec = &r->recs[tail & (LOG_RING - 1)];
+    rec->ns = now;
+    rec->level = level;
+    va_start(ap, fmt);
+    int n = vsnprintf(rec->text, LOG_TEXT, fmt, ap);
+    va_end(ap);
+    rec->len = n < 0 ? 0 : n >= LOG_TEXT ? LOG_TEXT - 1 : n;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// the ring stays on the writer's list, so lines still queued in it are written all the same;
+// its next owner goes on producing where this thread stopped
+void log_release(void){
+    if (mine == NULL) return;
+    pthread_mutex_lock(&ringsLock);
+    mine->spare = spare;
+    spare = mine;
+    pthread_mutex_unlock(&ringsLock);
+    mine = NULL;
+}
+
+void log_request_dump(void){
+    dumpWanted = 1;
+}
+
+// the writer's output, written once full and whenever the rings run dry
+static char batch[LOG_BATCH];
+static int batchLen;
+
+static void batch_flush(void){
+    fwrite(batch, 1, batchLen, stdout);
+    fflush(stdout);
+    batchLen = 0;
+}
+
+static void batch_add(long long ns, int level, int id, const char *text, int len){
+    if (batchLen + LOG_TEXT + 64 > LOG_BATCH) batch_flush();
+    batchLen += snprintf(batch + batchLen, LOG_BATCH - batchLen, "t=%lld.%06lld level=%s thread=%d %.*s\n",
+        ns / 1000000000, ns % 1000000000 / 1000, levels[level], id, len, text);
+}
+
+// writes out every queued line, returns how many
+static int log_drain(void){
+    int lines = 0;
+
+    pthread_mutex_lock(&ringsLock);
+    struct logring *r = rings;
+    pthread_mutex_unlock(&ringsLock);
+    for (; r != NULL; r = r->next) { // rings are only ever added at the front
+        unsigned head = r->head, tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, lines++) {
+            struct logrec *rec = &r->recs[head & (LOG_RING - 1)];
+            batch_add(rec->ns, rec->level, r->id, rec->text, rec->len);
+        }
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+        long dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0) {
+            char text[64];
+            int len = snprintf(text, sizeof(text), "dropped=%ld", dropped);
+            batch_add(log_now(), LOG_WARN, r->id, text, len);
+        }
+    }
+    if (batchLen > 0) batch_flush();
+    return lines;
+}
+
+static void *log_writer(void *arg){
+    struct timespec idle = { 0, LOG_IDLE_NS };
+    (void)arg;
+
+    for (;;) {
+        int stopping = !__atomic_load_n(&running, __ATOMIC_ACQUIRE);
+        int lines = log_drain();
+        if (dumpWanted) {
+            dumpWanted = 0;
+            if (dumper != NULL) dumper();
+            fflush(stdout);
+        }
+        if (stopping) return NULL;
+        if (lines == 0) nanosleep(&idle, NULL);
+    }
+}
+
+int log_start(int level, void (*dump)(void)){
+    sigset_t all, old;
+    int error;
+
+    logLevel = level;
+    dumper = dump;
+    fflush(stdout);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    // signals are for the threads serving players
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    error = pthread_create(&writer, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error != 0) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        fprintf(stderr, "log writer: %s\n", strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop(void){
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    // every thread but this one is gone, nobody logs into a ring anymore
+    while (rings != NULL) {
+        struct logring *next = rings->next;
+        free(rings);
+        rings = next;
+    }
+    spare = NULL;
+    mine = NULL;
+}
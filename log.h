@@ -0,0 +1,38 @@
+// log - leveled, rate-limited logging kept off the threads serving players
+//     Each thread formats its lines into its own lock-free ring; a background writer drains every
+//     ring and writes them to stdout in batches, as "t=<unix time> level=<level> thread=<ring> <text>"
+//     A thread over LOG_RATE lines a second, or whose ring is full, drops lines; the writer says how many
+//     Dumps of whole tables only happen when asked for (SIGUSR1 in ttts), on the writer thread
+
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+extern int logLevel; // lines above this level are dropped before they are formatted
+
+// starts the writer thread; dump, if not NULL, runs on it after log_request_dump()
+int log_start(int level, void (*dump)(void));
+
+// writes out whatever is still queued and stops the writer, later lines go straight to stdout
+void log_stop(void);
+
+// queues one line, text without the trailing newline; prefer the macros below
+void log_line(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// a thread about to exit hands its ring to the next thread that logs, instead of leaving it unused
+void log_release(void);
+
+// asks the writer to run the dump callback, safe to call from a signal handler
+void log_request_dump(void);
+
+#define log_at(level, ...) do { if ((level) <= logLevel) log_line((level), __VA_ARGS__); } while (0)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+#endif
@@ -37,8 +37,10 @@
 
 // NOTE: must use option -pthread when compiling!
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // syscall(), mmap flags for the io_uring engine, CPU affinity for workers
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -50,11 +52,38 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "board.h"
+#include "log.h"
+
+#define QUEUE_SIZE SOMAXCONN
+#define BUFSIZE 256
+#define LINE_CAP 512  // longest message (plus whatever is pipelined behind it) a connection may buffer
+#define MAX_FIELDS 8  // messages with more fields than this are invalid anyway
+#define HOSTSIZE 100
+#define PORTSIZE 10
+#define FD_TABLE_MAX (1 << 20) // descriptors past this (or past RLIMIT_NOFILE) are looked up in the list
+#define TIMED_LINES 8 // commands of one batch whose write is timed, the rest only up to their handler
 
-#define QUEUE_SIZE 8
+// connection engines selectable with -m
+#define ENGINE_THREADS 0 // a poller handing ready connections to a pool of worker threads
+#define ENGINE_EPOLL 1   // single-threaded edge-triggered event loop
+#define ENGINE_URING 2   // single-threaded io_uring loop, falls back to epoll
+int engine = ENGINE_THREADS;
 
-//lock stuff
-pthread_mutex_t lock;
 int count = 0;
 
 volatile int active = 1;
@@ -63,6 +92,12 @@ void handler(int signum){
     active = 0;
 }
 
+// SIGUSR1: the log writer dumps the connection and game tables
+void dump_handler(int signum){
+    (void)signum;
+    log_request_dump();
+}
+
 // set up signal handlers for primary thread
 // return a mask blocking those signals for worker threads
 // FIXME should check whether any of these actually succeeded
@@ -74,178 +109,996 @@ void install_handlers(sigset_t *mask){
 
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTERM, &act, NULL);
+
+    act.sa_handler = dump_handler;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &act, NULL);
+    act.sa_flags = 0;
+
+    // a peer that disconnects mid-write must not kill the server
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
     
     sigemptyset(mask);
     sigaddset(mask, SIGINT);
     sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGUSR1);
 }
 
+// deadlines a connection can miss, see timer_set(); each has its own length in timeouts[]
+#define TIMEOUT_HANDSHAKE 0 // from connecting until its PLAY is accepted
+#define TIMEOUT_LOBBY 1     // waiting for an opponent
+#define TIMEOUT_LINE 2      // a message that was started and not finished
+#define TIMEOUT_MOVE 3      // the game waits on the player: for its move, or its answer to a draw
+#define TIMEOUTS 4
+
+// a deadline, filed in its shard's timer wheel while it runs
+struct timer {
+    struct timer *next;
+    struct timer **link;   // what points at it, NULL while it is not running
+    unsigned long expires; // the wheel tick it is due at
+    struct connection_data *con;
+    int cause;
+};
+
 // data to be sent to worker threads
+// also carries the per-connection parsing state, so either engine can drive it
 typedef struct connection_data {
 	struct sockaddr_storage addr;
 	socklen_t addr_len;
 	int fd;
+    char host[HOSTSIZE];
+    char port[PORTSIZE];
+    char lineBuffer[LINE_CAP]; // received bytes not handled yet, messages are parsed in place
+    int lineLen;               // bytes in lineBuffer
+    int scanPos;               // where the search for the next newline resumes
+    int linePos;               // length of the message being handled, newline included
+    int ingame; //set to 1 after play
+    int searching;
+    int closing; // io_uring: our own shutdown is queued, waiting for the final recv completion
+    struct fdList *yourFd;
+    char name[51]; // name given with PLAY, kept so another shard can pair the player
+    int nameSize;
+    long long playAt; // when PLAY was handled, for the time-to-match histogram
+    struct waiter *waiter; // its entry in the shard's waiting queue while it waits for an opponent
+    struct name *entry; // its name in the registry, NULL until PLAY is accepted
+    struct Game *game; // the game it was paired into, held until the connection closes
+    int variant; // the game it asked for in PLAY
+    char rival[51]; // the opponent it challenged by name, empty for an open PLAY
+    int rivalSize;
+    struct shard *moving; // shard the connection is being handed to
+    struct connection_data *next; // link in a shard inbox
+    // outbound queue, see out_queue()
+    char *outBuf;
+    int outLen;
+    int outSize;
+    int stalled;     // requests are not read until the queue drains to OUT_LOW
+    int shutPending; // shut the socket down once the queue is flushed
+    int draining;    // only shut for writing then, what it still sends is dropped until EOF, see too_long()
+    int overflow;    // the queue hit OUT_LIMIT, the connection is being dropped
+    int corked;      // a batch of its requests is being handled, replies wait for out_uncork()
+    int batchReplies; // replies queued during the current batch
+    long writes;     // send syscalls (or io_uring SENDs) made for this connection
+    long batchStart; // writes when the batch began
+    pthread_mutex_t outLock; // threaded engine: the opponent's thread queues too
+    int polled;      // threaded engine: armed in the poller and handled by no worker, see poll_arm()
+    unsigned ready;  // threaded engine: the epoll events it was queued for
+    // io_uring: the part of the queue being sent
+    char *sendBuf;
+    int sendSize;
+    int sendLen;
+    int sendOff;
+    int sendBusy;
+    int armed; // io_uring: 1 while a recv is pending, 2 once it is being cancelled
+    int dead;  // closed while a send was pending, freed when it completes
+    // command latency, see handle_line() and latency_written()
+    long long readAt;  // when the bytes being handled were read
+    int timedLines;    // commands of the current batch waiting for their replies to be written
+    int timedCmd[TIMED_LINES];
+    long long timedAt[TIMED_LINES]; // when each one's handler returned
+    // deadlines, see timer_set()
+    struct timer deadline; // handshake, lobby or move: whichever the player is at
+    struct timer partial;  // while part of a message is buffered, only its owner starts it
+    int timersOff;         // being closed, its timers may not start again
+    int expired;           // it missed a deadline, a game it was in is forfeited
 }connection_data;
 
 
+// a player's line (or its departure) waiting in its game's mailbox
+// it lives on the poster's stack, the poster waits for done before touching its line buffer again
+struct gamemsg {
+    struct gamemsg *next;
+    struct connection_data *con;
+    int left;   // the player disconnected, see game_left()
+    int result; // what handle_line() returned for it
+    int done;
+};
+
+// games a player can ask for in PLAY; players are only paired with someone who asked for the same
+#define VARIANT_STANDARD 0 // 3×3, or the -b board
+#define VARIANT_ULTIMATE 1 // ultimate tic-tac-toe, see board.h
+#define VARIANTS 2
+
+// the commands a client may send, indexes of commands[]
+#define CMD_PLAY 0
+#define CMD_MOVE 1
+#define CMD_RSGN 2
+#define CMD_DRAW 3
+#define COMMANDS 4
+
+// replies that never change, encoded once by replies_init()
+#define REPLY_WAIT 0
+#define REPLY_DRAW_SUGGESTED 1
+#define REPLY_DRAW_REJECTED 2
+#define REPLY_INVALID_COMMAND 3
+#define REPLY_INCORRECT_BYTES 4
+#define REPLY_NOT_A_NUMBER 5
+#define REPLY_CANNOT_MEASURE 6
+#define REPLY_MESSAGE_TOO_LONG 7
+#define REPLY_ALREADY_IN_GAME 8
+#define REPLY_NAME_TOO_LONG 9
+#define REPLY_INVALID_OPPONENT 10
+#define REPLY_UNKNOWN_GAME 11
+#define REPLY_NAME_OCCUPIED 12
+#define REPLY_NOT_STARTED 13
+#define REPLY_DRAW_WAS_CALLED 14
+#define REPLY_WRONG_ROLE 15
+#define REPLY_WAIT_YOUR_TURN 16
+#define REPLY_WRONG_SUB_BOARD 17
+#define REPLY_SPACE_OCCUPIED 18
+#define REPLY_DRAW_ALREADY_CALLED 19
+#define REPLY_DRAW_NOT_CALLED 20
+#define REPLY_NO_MOVES_LEFT 21
+#define REPLY_DRAW_REACHED 22
+#define REPLY_OPPONENT_RESIGNED 23
+#define REPLY_OPPONENT_DISCONNECTED 24
+#define REPLY_OPPONENT_FORFEITED 25
+#define REPLY_TIMED_OUT 26
+#define REPLY_OUT_OF_TIME 27
+#define REPLY_OVERFLOWED 28
+#define REPLY_SERVER_BUSY 29
+#define REPLIES 30
+
 typedef struct Game{
     int gameNumber;
+    int variant;
     int playerOne; // whoever wrote play first
-    char *playerOneName;
+    char playerOneName[51];
     int playerOneSize;
     int playerTwo; // whoever wrote play second
-    char *playerTwoName;
+    char playerTwoName[51];
     int playerTwoSize;
     int turn; //0 is p1 and 1 is p2
-    char *grid;
+    struct board board; // X's and O's cells as bitmasks, the grid string is built for MOVD only
+    struct wideboard *wide; // -b: the N×N board played instead, NULL for 3×3 games
+    struct ultimate ultimate; // the boards of a VARIANT_ULTIMATE game
     int draw;
     int olive;
+    struct Game *prev; // NULL once the game is over
     struct Game *next;
+    // the game's actor: its players post their lines to the mailbox and whichever thread finds it idle
+    // runs them one at a time, so nothing above needs a lock, see actor_post()
+    struct gamemsg *mailbox; // newest first
+    int running; // a thread is draining the mailbox
+    struct connection_data *forfeit; // a player whose replies overflowed, see game_forfeit()
+    int refs;    // players still holding the game, the last one to let go frees it
 }Game;
 
-struct Game *gameList = NULL;
-int gameCount = 1;
 
-// linked list of connections
+// linked list of connections, also indexed by descriptor through the shard's byFd table
 typedef struct fdList{
     int fileDescriptor;
     int start;
     int ingame;
     int finished;
+    struct connection_data *con; // owning connection state
+    struct fdList *prev;
     struct fdList *next;
 }fdList;
 
-struct fdList *fileDescriptors = NULL;
+// fixed-size object pools for what every connection and game allocates: connections, their fdList
+// nodes and games. Objects are carved out of slabs and recycled, the heap only sees whole slabs.
+// Each thread keeps a short free list of its own; the pool's shared list behind a lock refills it and
+// takes its overflow, since the threaded engine often frees an object on another thread than made it
+#define SLAB_OBJECTS 64  // objects carved per slab
+#define CACHE_OBJECTS 32 // a thread's list hands half of itself back to the shared one past this
+#define SLAB_HEAD 16     // the slab's link, keeps the objects behind it 16-byte aligned
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#endif
+
+#define POOL_CONN 0
+#define POOL_FD 1
+#define POOL_GAME 2
+#define POOL_WIDE 3 // -b boards, sized once the option is known
+#define POOL_KINDS 4
+
+struct objpool {
+    const char *name;
+    size_t size;     // object size rounded up to 16
+    pthread_mutex_t lock;
+    void *free;      // shared free list, linked through each object's first word
+    int freeCount;
+    void *slabs;     // every slab carved, linked through their first word
+    long slabCount;
+    long arena;      // objects preallocated at startup (-p)
+    // folded in from the threads' own counters, see cache_fold()
+    long allocs;
+    long frees;
+    long local;      // allocations served from the calling thread's own list
+};
+
+struct objpool objpools[POOL_KINDS] = {
+    { .name = "connections", .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .name = "fd nodes", .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .name = "games", .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .name = "wide boards", .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+int arenaPlayers = 0; // -p: connections (and their games) to preallocate at startup, 0 for none
+int wideBoards = 0;   // -b: games are played on N×N boards (see board.h) instead of 3×3
+int boardSide = 3, boardRun = 3;
+
+struct objcache {
+    void *head;
+    int count;
+    long allocs;
+    long frees;
+    long local;
+};
+
+__thread struct objcache objcaches[POOL_KINDS];
+
+void pools_init(void){
+    objpools[POOL_CONN].size = (sizeof(struct connection_data) + 15) & ~(size_t)15;
+    objpools[POOL_FD].size = (sizeof(struct fdList) + 15) & ~(size_t)15;
+    objpools[POOL_GAME].size = (sizeof(struct Game) + 15) & ~(size_t)15;
+    objpools[POOL_WIDE].size = ((size_t)wide_bytes() + 15) & ~(size_t)15;
+}
 
+// adds a slab of n objects to the shared list, called under the pool's lock
+int pool_carve(struct objpool *p, int n){
+    char *slab = malloc(SLAB_HEAD + (size_t)n * p->size);
+    if (slab == NULL) return -1;
+    *(void **)slab = p->slabs;
+    p->slabs = slab;
+    p->slabCount++;
+    for (int i = 0; i < n; i++) {
+        char *obj = slab + SLAB_HEAD + (size_t)i * p->size;
+        *(void **)obj = p->free;
+        p->free = obj;
+        // only the link stays addressable while the object is free, so ASAN still catches use after free
+        ASAN_POISON_MEMORY_REGION(obj + sizeof(void *), p->size - sizeof(void *));
+    }
+    p->freeCount += n;
+    return 0;
+}
 
-//inserts socket into LL
-struct fdList *insertFdList(int fd, struct fdList *head){
+// arena mode: carves room for players connections (and their games) up front
+int pools_reserve(int players){
+    int want[POOL_KINDS] = { players, players, players / 2 + 1, wideBoards ? players / 2 + 1 : 0 };
+    for (int i = 0; i < POOL_KINDS; i++) {
+        if (want[i] == 0) continue;
+        pthread_mutex_lock(&objpools[i].lock);
+        int error = pool_carve(&objpools[i], want[i]);
+        if (error == 0) objpools[i].arena += want[i];
+        pthread_mutex_unlock(&objpools[i].lock);
+        if (error) return -1;
+    }
+    return 0;
+}
 
-    pthread_mutex_lock(&lock);
+// moves the thread's counters into the pool, called under its lock
+void cache_fold(struct objpool *p, struct objcache *c){
+    p->allocs += c->allocs;
+    p->frees += c->frees;
+    p->local += c->local;
+    c->allocs = c->frees = c->local = 0;
+}
 
+// an object of the given kind, not zeroed
+void *obj_alloc(int kind){
+    struct objcache *c = &objcaches[kind];
+    struct objpool *p = &objpools[kind];
+
+    if (c->head != NULL) {
+        c->local++;
+    } else { // take up to half a list's worth from the shared list, carving a slab if it is empty
+        pthread_mutex_lock(&p->lock);
+        if (p->free == NULL && pool_carve(p, SLAB_OBJECTS) == -1) {
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        while (p->free != NULL && c->count < CACHE_OBJECTS / 2) {
+            void *obj = p->free;
+            p->free = *(void **)obj;
+            p->freeCount--;
+            *(void **)obj = c->head;
+            c->head = obj;
+            c->count++;
+        }
+        cache_fold(p, c);
+        pthread_mutex_unlock(&p->lock);
+    }
+    void *obj = c->head;
+    c->head = *(void **)obj;
+    c->count--;
+    c->allocs++;
+    ASAN_UNPOISON_MEMORY_REGION(obj, p->size);
+    return obj;
+}
 
-    struct fdList *sub = calloc(1, sizeof(struct fdList));
+// an object of the given kind, zeroed like calloc()
+void *obj_calloc(int kind){
+    void *obj = obj_alloc(kind);
+    if (obj != NULL) memset(obj, 0, objpools[kind].size);
+    return obj;
+}
 
-    sub->fileDescriptor = fd;
-    sub->start = 0;
-    sub->ingame = 0;
-    sub->finished = 0;
-    sub->next = NULL;
-    //if LL is empty
-    if (head == NULL){
-        head = sub;
-        pthread_mutex_unlock(&lock);
-	    return head;
-    } else {
-        struct fdList *current = head;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = sub;
+// hands half of the thread's list back to the shared one, or all of it with all set
+void cache_spill(int kind, int all){
+    struct objcache *c = &objcaches[kind];
+    struct objpool *p = &objpools[kind];
+
+    pthread_mutex_lock(&p->lock);
+    while (c->head != NULL && (all || c->count > CACHE_OBJECTS / 2)) {
+        void *obj = c->head;
+        c->head = *(void **)obj;
+        c->count--;
+        *(void **)obj = p->free;
+        p->free = obj;
+        p->freeCount++;
     }
-    pthread_mutex_unlock(&lock);
-    return head;
+    cache_fold(p, c);
+    pthread_mutex_unlock(&p->lock);
 }
 
-void traverseFileDescriptors(struct fdList *head){
-    struct fdList *current = head;
-    while (current != NULL) {
-        printf("fd: %d, ", current->fileDescriptor);
-        printf("looking for game: %d, ", current->start);
-        printf("in game: %d", current->ingame);
+void obj_free(int kind, void *obj){
+    struct objcache *c = &objcaches[kind];
+
+    if (obj == NULL) return;
+    ASAN_POISON_MEMORY_REGION((char *)obj + sizeof(void *), objpools[kind].size - sizeof(void *));
+    *(void **)obj = c->head;
+    c->head = obj;
+    c->count++;
+    c->frees++;
+    if (c->count > CACHE_OBJECTS) cache_spill(kind, 0);
+}
+
+// a thread that is about to exit hands its lists and counters back
+void pools_flush(void){
+    for (int i = 0; i < POOL_KINDS; i++) cache_spill(i, 1);
+}
+
+void pools_print(void){
+    for (int i = 0; i < POOL_KINDS; i++) {
+        struct objpool *p = &objpools[i];
+        if (p->allocs == 0) continue;
+        printf("pool %s: %ld allocations (%.0f%% from the thread's own list), %ld frees, %ld slabs",
+            p->name, p->allocs, 100.0 * p->local / p->allocs, p->frees, p->slabCount);
+        if (p->arena > 0) printf(", arena of %ld", p->arena);
+        puts("");
+    }
+}
 
-        if (current->next != NULL){
-		    printf(" | ");
+// releases every slab, whatever is still in use with them
+void pools_free(void){
+    for (int i = 0; i < POOL_KINDS; i++) {
+        void *slab = objpools[i].slabs;
+        while (slab != NULL) {
+            void *next = *(void **)slab;
+            free(slab);
+            slab = next;
         }
-        current = current->next;
+        objpools[i].slabs = objpools[i].free = NULL;
     }
-	printf("\n");
+}
 
-    return;
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-struct fdList *searchFileList(int fileDesc){
-    struct fdList *current = fileDescriptors;
-    while (current != NULL) {
-        if (current->fileDescriptor == fileDesc){
-            return current;
-        }
-        current = current->next;
+// CPU time the calling thread has used
+long long cpu_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// power-of-two buckets of microseconds: bucket i counts samples up to 2^i us
+#define HIST_BUCKETS 24 // the last one also takes anything slower than 2^23 us (8 s)
+struct histogram {
+    long counts[HIST_BUCKETS];
+    long samples;
+};
+
+void hist_add(struct histogram *h, long long ns){
+    long long us = ns / 1000;
+    int i = 0;
+    while (i < HIST_BUCKETS - 1 && us > (1LL << i)) i++;
+    // the threaded engine's players record into their shard's histograms from different threads
+    __atomic_fetch_add(&h->counts[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->samples, 1, __ATOMIC_RELAXED);
+}
+
+void hist_merge(struct histogram *into, struct histogram *from){
+    for (int i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->samples += from->samples;
+}
+
+// prints the non-empty buckets, with the bucket holding the median and the 99th percentile
+void hist_print(const char *title, struct histogram *h){
+    long seen = 0;
+    int p50 = -1, p99 = -1;
+
+    if (h->samples == 0) return;
+    printf("%s (%ld samples):\n", title, h->samples);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (p50 == -1 && seen * 2 >= h->samples) p50 = i;
+        if (p99 == -1 && seen * 100 >= h->samples * 99) p99 = i;
+        if (h->counts[i]) printf("  <= %8lld us: %ld\n", 1LL << i, h->counts[i]);
     }
-    return NULL;
+    printf("  p50 <= %lld us, p99 <= %lld us\n", 1LL << p50, 1LL << p99);
 }
 
-struct fdList *finishedGame(int target, struct fdList *head){
-    pthread_mutex_lock(&lock);
-    struct fdList *current = head;
-    //If head is the target
-    while (current != NULL) {
-        if (current->finished == 0 && current->fileDescriptor == target){
-            current->finished = 1;
-            current->ingame = 0;
-            pthread_mutex_unlock(&lock);
-            return current;
+// counters served by the stats listener (-s), see stats_serve()
+// every thread counts into a block of its own, so counting is a plain store with no shared
+// cache line; a scrape sums the blocks, gauges are the difference of two counters
+#define STAT_ACCEPTED 0       // connections accepted
+#define STAT_CLOSED 1         // connections torn down
+#define STAT_GAMES_STARTED 2
+#define STAT_GAMES_ENDED 3
+#define STAT_BYTES_IN 4
+#define STAT_BYTES_OUT 5
+#define STAT_LEFT 6           // games forfeited by disconnecting
+#define STAT_OVERFLOWED 7     // games forfeited by not reading replies
+#define STAT_EXPIRED 8        // games forfeited by missing a deadline
+#define STAT_TIMEOUT 9        // connections dropped for missing a deadline, TIMEOUTS of them
+#define STAT_COMMAND (STAT_TIMEOUT + TIMEOUTS) // messages per command, COMMANDS + 1 of them: the last counts unknown ones
+#define STAT_REPLY (STAT_COMMAND + COMMANDS + 1) // fixed replies sent, REPLIES of them
+#define STATS (STAT_REPLY + REPLIES)
+#define CACHE_LINE 64
+
+// HDR-style histogram of nanoseconds: exact below 32, then 16 linear buckets per power of two,
+// so any value is off by at most 1/16; values from 2^35 ns (34 s) on share the last bucket
+#define HDR_SUB_BITS 4
+#define HDR_SUB (1 << HDR_SUB_BITS)
+#define HDR_MAX_BIT 34
+#define HDR_BUCKETS ((HDR_MAX_BIT - HDR_SUB_BITS + 2) * HDR_SUB)
+struct hdr {
+    long counts[HDR_BUCKETS];
+    long samples;
+    long long sum;
+};
+
+int hdr_bucket(long long ns){
+    if (ns < 2 * HDR_SUB) return ns < 0 ? 0 : ns;
+    int top = 63 - __builtin_clzll(ns);
+    if (top > HDR_MAX_BIT) return HDR_BUCKETS - 1;
+    int shift = top - HDR_SUB_BITS;
+    return HDR_SUB * (shift + 1) + (ns >> shift) - HDR_SUB;
+}
+
+// the largest value bucket i holds
+long long hdr_top(int i){
+    if (i < 2 * HDR_SUB) return i;
+    int shift = i / HDR_SUB - 1;
+    return ((long long)(i % HDR_SUB + HDR_SUB) << shift) + (1LL << shift) - 1;
+}
+
+// only the thread owning the histogram adds to it, the stores just have to be whole for a scrape
+void hdr_add(struct hdr *h, long long ns){
+    int i = hdr_bucket(ns);
+    __atomic_store_n(&h->counts[i], h->counts[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->samples, h->samples + 1, __ATOMIC_RELAXED);
+}
+
+void hdr_merge(struct hdr *into, struct hdr *from){
+    for (int i = 0; i < HDR_BUCKETS; i++) into->counts[i] += __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+    into->samples += __atomic_load_n(&from->samples, __ATOMIC_RELAXED);
+    into->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+}
+
+// the value below which permille thousandths of the samples fall, rounded up to its bucket's top
+long long hdr_permille(struct hdr *h, long permille){
+    long want = (h->samples * permille + 999) / 1000, seen = 0;
+    for (int i = 0; i < HDR_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want && seen > 0) return hdr_top(i);
+    }
+    return 0;
+}
+
+// stages of a command's latency, timed per command by handle_line() and latency_written()
+#define LAT_PARSE 0  // from reading it to the message parsed and checked
+#define LAT_UPDATE 1 // its handler: game state updated, replies queued
+#define LAT_WRITE 2  // from there until the batch's replies were written
+#define LAT_TOTAL 3  // from reading it to the last write
+#define LAT_CPU 4    // thread CPU time spent parsing and handling it
+#define LAT_STAGES 5
+const char *latStages[LAT_STAGES] = { "parse", "update", "write", "total", "cpu" };
+
+struct stats {
+    long counts[STATS];
+    struct hdr latency[COMMANDS][LAT_STAGES];
+    struct stats *next;
+};
+
+struct stats *allStats; // every thread that counted, newest first; freed at exit
+pthread_mutex_t allStatsLock = PTHREAD_MUTEX_INITIALIZER;
+__thread struct stats *myStats;
+
+// the calling thread's block, cache-line aligned and rounded up to whole lines
+struct stats *stats_mine(void){
+    size_t size = (sizeof(struct stats) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    void *block;
+
+    if (posix_memalign(&block, CACHE_LINE, size) != 0) return NULL;
+    memset(block, 0, size);
+    myStats = block;
+    pthread_mutex_lock(&allStatsLock);
+    myStats->next = allStats;
+    allStats = myStats;
+    pthread_mutex_unlock(&allStatsLock);
+    return myStats;
+}
+
+void stat_add(int which, long n){
+    struct stats *mine = myStats != NULL ? myStats : stats_mine();
+    if (mine == NULL) return;
+    // only this thread writes it, the store just has to be whole for the scraper
+    __atomic_store_n(&mine->counts[which], mine->counts[which] + n, __ATOMIC_RELAXED);
+}
+
+void stat_latency(int cmd, int stage, long long ns){
+    struct stats *mine = myStats != NULL ? myStats : stats_mine();
+    if (mine != NULL) hdr_add(&mine->latency[cmd][stage], ns);
+}
+
+// adds up every thread's histogram of one command's stage
+void stats_latency(int cmd, int stage, struct hdr *into){
+    memset(into, 0, sizeof(struct hdr));
+    pthread_mutex_lock(&allStatsLock);
+    struct stats *block = allStats;
+    pthread_mutex_unlock(&allStatsLock);
+    for (; block != NULL; block = block->next) hdr_merge(into, &block->latency[cmd][stage]);
+}
+
+// adds up every thread's counters, STATS of them
+void stats_sum(long *into){
+    memset(into, 0, sizeof(long) * STATS);
+    pthread_mutex_lock(&allStatsLock);
+    struct stats *block = allStats;
+    pthread_mutex_unlock(&allStatsLock);
+    for (; block != NULL; block = block->next) { // blocks are only ever added at the front
+        for (int i = 0; i < STATS; i++) into[i] += __atomic_load_n(&block->counts[i], __ATOMIC_RELAXED);
+    }
+}
+
+void stats_free(void){
+    while (allStats != NULL) {
+        struct stats *next = allStats->next;
+        free(allStats);
+        allStats = next;
+    }
+    myStats = NULL;
+}
+
+// a player in a shard's waiting queue
+// the entry outlives the connection: whoever pops it frees it, after checking it was not cancelled
+struct waiter {
+    struct connection_data *con; // only valid while cancelled is 0
+    int fd; // the player's descriptor, tells whose stripe lock guards cancelled
+    int variant; // the queue it waits in
+    int cancelled; // the player left before being paired, set under its stripe lock
+};
+
+// lock-free bounded multi-producer/multi-consumer queue of waiting players (Vyukov's array queue)
+// every cell carries a sequence number that tells producers and consumers whose turn it is
+#define WAITQ_SIZE 1024 // cells per shard, must be a power of 2; the threaded engine may need more
+struct waitcell {
+    unsigned seq;
+    struct waiter *w;
+};
+
+struct waitq {
+    struct waitcell *cells;
+    unsigned mask;
+    char pad0[64]; // producers and consumers work on separate cache lines
+    unsigned tail; // next cell to fill
+    char pad1[64];
+    unsigned head; // next cell to empty
+    char pad2[64];
+    int count; // filled cells nobody has reserved yet, see waitq_reserve()
+};
+
+int waitq_init(struct waitq *q, unsigned size){
+    q->cells = calloc(size, sizeof(struct waitcell));
+    if (q->cells == NULL) return -1;
+    for (unsigned i = 0; i < size; i++) q->cells[i].seq = i;
+    q->mask = size - 1;
+    q->head = q->tail = 0;
+    q->count = 0;
+    return 0;
+}
+
+// returns -1 if the queue is full
+int waitq_push(struct waitq *q, struct waiter *w){
+    unsigned pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        struct waitcell *cell = &q->cells[pos & q->mask];
+        int diff = (int)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->w = w;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                __atomic_fetch_add(&q->count, 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
         }
-        else if (current->finished == 1 && current->fileDescriptor == target){
-            pthread_mutex_unlock(&lock);
-            return current;
+    }
+}
+
+// returns NULL if the oldest cell is empty, or its producer has not finished filling it
+struct waiter *waitq_pop(struct waitq *q){
+    unsigned pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        struct waitcell *cell = &q->cells[pos & q->mask];
+        int diff = (int)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                struct waiter *w = cell->w;
+                __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return w;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
         }
-        current = current->next;
     }
-    pthread_mutex_unlock(&lock);
+}
+
+// claims n entries for the caller, returns 0 if there are fewer than n
+// a claimed entry is always there to pop, so two players can never each pop one and give up
+int waitq_reserve(struct waitq *q, int n){
+    int count = __atomic_load_n(&q->count, __ATOMIC_ACQUIRE);
+    while (count >= n) {
+        if (__atomic_compare_exchange_n(&q->count, &count, count - n, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 1;
+    }
+    return 0;
+}
+
+// pops an entry claimed with waitq_reserve(), waiting out a producer that is still filling it in
+struct waiter *waitq_take(struct waitq *q){
+    struct waiter *w;
+    while ((w = waitq_pop(q)) == NULL) sched_yield();
+    return w;
+}
+
+// a slice of a shard's tables: the connections whose descriptor and the games whose number fall in it,
+// each with its own lock, so threads serving players in different stripes never wait on each other
+// lock order: the stripes of a game's two players, lower one first (pair_lock()), then the name
+// registry, then a stripe's gamesLock, then the timer wheel's lock, then a connection's outLock
+#define STRIPES 16 // stripes per shard, -l changes it; must be a power of 2
+struct stripe {
+    pthread_mutex_t lock;      // recursive: its connections' fdList nodes and their finished flags
+    pthread_mutex_t gamesLock; // only the links of its game list, nothing else is locked under it
+    struct fdList *fds;  // head of its connection list, not a connection
+    struct Game *games;  // head of its game list, not a game
+    char pad[64];        // neighbouring stripes' locks on separate cache lines
+};
+
+int nstripes = STRIPES;
+
+// timer wheel: hierarchical, so starting, stopping and expiring a deadline costs the same however many run
+// level 0 has a slot per tick, level k one per 64^k ticks; a level's slot is spread over the levels
+// below it as the ticks reach it, and whatever lands in the slot of level 0 being ticked expires
+#define TIMER_TICK_MS 100 // resolution, a deadline passes up to this much late
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4    // 64^4 ticks ahead at most, 19 days; anything later waits in the last slot
+struct wheel {
+    struct timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    unsigned long now; // ticks run so far
+    long long start;   // when tick 0 was
+    long running;      // timers in it, the loops only tick while there are any
+    pthread_mutex_t lock; // threaded engine: shard 0's is shared by every connection thread and the ticker
+};
+
+// everything one event loop owns: its games, its connections and their locks
+// the threaded engine runs a single shard shared by every connection thread;
+// with -w N each worker loop owns a shard and nothing in it is touched by other workers
+struct shard {
+    int index;
+    struct stripe *stripes; // nstripes of them
+    struct fdList **byFd; // every stripe's connections indexed by descriptor, fdSlots of them
+    int fdSlots;
+    int gameCount; // next game number, shards hand out interleaved numbers
+    struct waitq waitq[VARIANTS]; // players waiting for an opponent here, one queue per game variant
+    int waiting[VARIANTS];   // of those, the ones still connected, read by other shards
+    int listener;
+    int epfd;
+    struct uring *ring; // set while the io_uring engine is running
+    struct connection_data *lingering; // io_uring: closed connections whose last send is in flight
+    // connections handed over by other shards, announced through wakefd
+    pthread_mutex_t inboxLock;
+    struct connection_data *inbox;
+    int wakefd;
+    uint64_t wakeval;
+    pthread_t tid;
+    long games;
+    long handoffsIn;
+    long handoffsOut;
+    long challenges; // games started by players who named each other
+    // game actors, see actor_post()
+    long actorRuns;     // times a thread took over a game and drained its mailbox
+    long actorLines;    // lines and departures run
+    long actorForeign;  // of those, the ones run by the opponent's thread for its poster
+    long actorWaits;    // posts that found the game busy and waited for it
+    struct histogram matchTimes; // from PLAY to BEGN, for both players of each game
+    struct wheel wheel; // deadlines of its connections
+    // pipelining: batches of requests whose replies went out together, see out_uncork()
+    long batches;
+    long batchReplies;
+    long batchWrites;
+};
+
+struct shard *shards = NULL;
+int nshards = 1;
+__thread struct shard *shard; // the shard the calling thread works on
+
+// per variant, the only shard other shards may send a player to for pairing, -1 if none
+// a shard advertises itself here while it has a waiting player
+int lobby[VARIANTS] = { -1, -1 };
+
+// counts players starting or stopping to wait for an opponent on this shard
+// withdraws the lobby advertisement once nobody is waiting here anymore
+void shard_waiting(int variant, int delta){
+    int self = shard->index;
+    if (__atomic_add_fetch(&shard->waiting[variant], delta, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_compare_exchange_n(&lobby[variant], &self, -1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+}
+
+struct stripe *stripe_of(int fd){
+    return &shard->stripes[(unsigned)fd & (nstripes - 1)];
+}
+
+void fd_lock(int fd){
+    pthread_mutex_lock(&stripe_of(fd)->lock);
+}
+
+void fd_unlock(int fd){
+    pthread_mutex_unlock(&stripe_of(fd)->lock);
+}
+
+// locks what a move or the end of a game touches: both players' stripes, the lower one first,
+// so two threads working on the same game never each hold one and wait for the other
+void pair_lock(int one, int two){
+    struct stripe *a = stripe_of(one), *b = stripe_of(two);
+    if (a > b) {
+        struct stripe *t = a;
+        a = b;
+        b = t;
+    }
+    pthread_mutex_lock(&a->lock);
+    if (b != a) pthread_mutex_lock(&b->lock);
+}
+
+void pair_unlock(int one, int two){
+    struct stripe *a = stripe_of(one), *b = stripe_of(two);
+    if (b != a) pthread_mutex_unlock(&b->lock);
+    pthread_mutex_unlock(&a->lock);
+}
+
+// every name given with PLAY, on any shard: a name is in use at most once, and a challenged player
+// is found without looking through anyone else; chained hash table, entries own their copy of the name
+// lock order: players' stripe locks first, then names.lock
+struct name {
+    struct name *next; // in its bucket
+    unsigned hash;
+    struct connection_data *con; // the player using it
+    struct shard *home; // where the player waits for the opponent it challenged, NULL otherwise
+    int size;
+    char text[]; // NUL-terminated
+};
+
+#define NAMES_BUCKETS 1024 // initial bucket count, doubles whenever there are more names than buckets
+struct registry {
+    struct name **buckets;
+    unsigned mask;
+    int count;
+    pthread_mutex_t lock;
+} names = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+// FNV-1a
+unsigned name_hash(const char *text, int size){
+    unsigned h = 2166136261u;
+    for (int i = 0; i < size; i++) h = (h ^ (unsigned char)text[i]) * 16777619u;
+    return h;
+}
+
+int names_init(void){
+    names.buckets = calloc(NAMES_BUCKETS, sizeof(struct name *));
+    names.mask = NAMES_BUCKETS - 1;
+    return names.buckets == NULL ? -1 : 0;
+}
+
+// called with names.lock held
+struct name *names_find(const char *text, int size){
+    unsigned h = name_hash(text, size);
+    for (struct name *n = names.buckets[h & names.mask]; n != NULL; n = n->next) {
+        if (n->hash == h && n->size == size && memcmp(n->text, text, size) == 0) return n;
+    }
     return NULL;
 }
 
-int isFinished(int target){
-    struct fdList *current = fileDescriptors;
-    while (current != NULL) {
-        if (current->fileDescriptor == target && current->finished == 1){
-            return 1;
+// doubles the bucket array, called with names.lock held
+void names_grow(void){
+    unsigned size = (names.mask + 1) * 2;
+    struct name **buckets = calloc(size, sizeof(struct name *));
+    if (buckets == NULL) return; // the chains just get longer
+
+    for (unsigned i = 0; i <= names.mask; i++) {
+        struct name *n, *next;
+        for (n = names.buckets[i]; n != NULL; n = next) {
+            next = n->next;
+            n->next = buckets[n->hash & (size - 1)];
+            buckets[n->hash & (size - 1)] = n;
         }
-        current = current->next;
     }
-    return 0;
+    free(names.buckets);
+    names.buckets = buckets;
+    names.mask = size - 1;
+}
+
+// gives con->name to the player, returns 0 if someone else has it and -1 if there was no memory for it
+int names_claim(struct connection_data *con){
+    struct name *n;
+
+    pthread_mutex_lock(&names.lock);
+    if (names_find(con->name, con->nameSize) != NULL) {
+        pthread_mutex_unlock(&names.lock);
+        return 0;
+    }
+    n = malloc(sizeof(struct name) + con->nameSize + 1);
+    if (n != NULL) {
+        n->hash = name_hash(con->name, con->nameSize);
+        n->con = con;
+        n->home = NULL;
+        n->size = con->nameSize;
+        memcpy(n->text, con->name, con->nameSize + 1);
+        n->next = names.buckets[n->hash & names.mask];
+        names.buckets[n->hash & names.mask] = n;
+        if (++names.count > (int)names.mask + 1) names_grow();
+        con->entry = n;
+    }
+    pthread_mutex_unlock(&names.lock);
+    return n != NULL ? 1 : -1;
+}
+
+// frees a leaving player's name for others to use
+void names_release(struct connection_data *con){
+    if (con->entry == NULL) return;
+
+    pthread_mutex_lock(&names.lock);
+    struct name **link = &names.buckets[con->entry->hash & names.mask];
+    while (*link != con->entry) link = &(*link)->next;
+    *link = con->entry->next;
+    names.count--;
+    pthread_mutex_unlock(&names.lock);
+    free(con->entry);
+    con->entry = NULL;
 }
 
-struct fdList *deleteFd(int target, struct fdList *head){
-    pthread_mutex_lock(&lock);
-    struct fdList *current = head;
-    struct fdList *prev = current;
-    //If head is the target
-    if (current == NULL){
-        pthread_mutex_unlock(&lock);
-        return head;
+void names_free(void){
+    for (unsigned i = 0; i <= names.mask; i++) {
+        struct name *n, *next;
+        for (n = names.buckets[i]; n != NULL; n = next) {
+            next = n->next;
+            free(n);
+        }
     }
-    if (current->fileDescriptor == target){
-        head = head->next;
-        free(current);
-        pthread_mutex_unlock(&lock);
-        return head;
+    free(names.buckets);
+    names.buckets = NULL;
+}
+
+
+//inserts socket into its stripe's LL, right behind the head so it takes the same time however many are connected
+// returns NULL if no node could be allocated
+struct fdList *insertFdList(int fd){
+    struct stripe *stripe = stripe_of(fd);
+    struct fdList *sub = obj_calloc(POOL_FD);
+    if (sub == NULL) return NULL;
+
+    sub->fileDescriptor = fd;
+    sub->start = 0;
+    sub->ingame = 0;
+    sub->finished = 0;
+    sub->con = NULL;
+
+    pthread_mutex_lock(&stripe->lock);
+    if (fd >= 0 && fd < shard->fdSlots) shard->byFd[fd] = sub;
+    sub->prev = stripe->fds;
+    sub->next = stripe->fds->next;
+    if (stripe->fds->next != NULL) stripe->fds->next->prev = sub;
+    stripe->fds->next = sub;
+    pthread_mutex_unlock(&stripe->lock);
+    return sub;
+}
+
+// dumps a shard's connections, only on request: see dump_tables()
+void traverseFileDescriptors(struct shard *s){
+    for (int i = 0; i < nstripes; i++) {
+        struct stripe *stripe = &s->stripes[i];
+        pthread_mutex_lock(&stripe->lock);
+        for (struct fdList *current = stripe->fds->next; current != NULL; current = current->next) {
+            printf("shard=%d fd=%d looking=%d ingame=%d\n", s->index, current->fileDescriptor,
+                current->start, current->ingame);
+        }
+        pthread_mutex_unlock(&stripe->lock);
     }
 
-    //Removing middle of the pack
+    return;
+}
+
+struct fdList *searchFileList(int fileDesc){
+    if (fileDesc >= 0 && fileDesc < shard->fdSlots) return shard->byFd[fileDesc];
+
+    struct fdList *current = stripe_of(fileDesc)->fds->next;
     while (current != NULL) {
-        if (current->fileDescriptor == target){
-            if (current->next == NULL){
-                prev->next = NULL;
-                free(current);
-                pthread_mutex_unlock(&lock);
-                return head;
-            }
-            prev->next = current->next;
-            free(current);
-            pthread_mutex_unlock(&lock);
-            return head;
+        if (current->fileDescriptor == fileDesc){
+            return current;
         }
-        prev = current;
         current = current->next;
     }
-    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+struct fdList *finishedGame(int target){
+    fd_lock(target);
+    struct fdList *current = searchFileList(target);
+    if (current != NULL && current->finished == 0){
+        current->finished = 1;
+        current->ingame = 0;
+    }
+    fd_unlock(target);
+    return current;
+}
+
+int isFinished(int target){
+    struct fdList *current = searchFileList(target);
+    return current != NULL && current->finished == 1;
+}
 
-    return head;
+void deleteFd(int target){
+    fd_lock(target);
+    struct fdList *current = searchFileList(target);
+    if (current != NULL){
+        current->prev->next = current->next;
+        if (current->next != NULL) current->next->prev = current->prev;
+        if (target >= 0 && target < shard->fdSlots) shard->byFd[target] = NULL;
+        obj_free(POOL_FD, current);
+    }
+    fd_unlock(target);
 }
 
-int open_listener(char *service, int queue_size){
+
+// host NULL listens on every address
+int open_listener(char *host, char *service, int queue_size, int reuseport){
     struct addrinfo hint, *info_list, *info;
     int error, sock;
     int reuse = 1;  
@@ -257,7 +1110,7 @@ int open_listener(char *service, int queue_size){
     hint.ai_flags    = AI_PASSIVE;
 
     // obtain information for listening socket
-    error = getaddrinfo(NULL, service, &hint, &info_list);
+    error = getaddrinfo(host, service, &hint, &info_list);
     if (error) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(error));
         return -1;
@@ -276,6 +1129,11 @@ int open_listener(char *service, int queue_size){
             close(sock);
             continue;
         }
+        if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            perror("setsockopt");
+            close(sock);
+            continue;
+        }
 
         // bind socket to requested port
         error = bind(sock, info->ai_addr, info->ai_addrlen);
@@ -306,1793 +1164,3365 @@ int open_listener(char *service, int queue_size){
     return sock;
 }
 
-typedef struct readList{
-    char *data;
-	int size;
-    struct readList *next;
-}readList;
-
-struct readList *deleteRL(char *target, struct readList *head){
-    struct readList *current = head;
-    //If head is the target
-    if (current == NULL){
-        return head;
-    }
-    if (current->data == target){
-        head = head->next;
-        free(current);
-        return head;
-    }
+// io_uring plumbing, driven through the raw syscalls (no liburing)
+// the event loop itself is run_uring_loop(); everything here only queues submissions
+#define URING_ENTRIES 256     // submission queue size
+#define URING_CQ_ENTRIES 4096 // completion queue size, multishot ops post many completions per submission
+#define URING_BUFFERS 1024    // provided receive buffers of BUFSIZE bytes, must be a power of 2
+#define URING_BGID 0          // buffer group of the provided receive buffers
+
+// operation kind, kept in the low bits of user_data
+#define URING_RECV 0   // user_data is the connection_data
+#define URING_SEND 1   // user_data is the connection_data
+#define URING_ACCEPT 2
+#define URING_OTHER 3  // shutdown, close and the stats timer
+#define URING_TAG_MASK 3UL
+
+typedef struct uring {
+    int fd;
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    void *sq_ptr;
+    size_t sq_len;
+    size_t sqes_len;
+    unsigned to_submit;
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *cq_ptr;
+    size_t cq_len;
+    // provided receive buffers
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    char *bufs;
+    unsigned short br_tail;
+    // the timer wheel's tick, a timeout kept armed while the shard has timers running
+    struct __kernel_timespec tick;
+    int ticking;
+    // counters, reported once a second by the stats timer
+    long submissions;
+    long completions;
+    long enters;
+    long sends;
+    long ticks; // left out of the report
+}uring;
+
+int uring_setup(unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
 
-    return head;
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
 }
 
-struct readList *insertRL(char *word, struct readList *head, int len){
-    struct readList *current = head;
+int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
 
-    struct readList *sub = (struct readList *)malloc(sizeof(struct readList));
-    sub->data = word;
-	sub->size = len;
-    //if LL is empty
-    if (head == NULL){
-	    sub->next = NULL;
-        head = sub;
-	    return head;
-    }
-    while (current->next != NULL) {
-        current = current->next;
-    }
+// hands a receive buffer back to the kernel
+void uring_recycle(struct uring *r, unsigned short bid){
+    struct io_uring_buf *buf = &r->br->bufs[r->br_tail & (URING_BUFFERS - 1)];
+    buf->addr = (unsigned long)(r->bufs + (size_t)bid * BUFSIZE);
+    buf->len = BUFSIZE;
+    buf->bid = bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
 
-    current->next = sub;
-    sub->next = NULL;
-    return head;
+void uring_free(struct uring *r){
+    if (r->br) munmap(r->br, r->br_len);
+    free(r->bufs);
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr && r->cq_ptr != MAP_FAILED) munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0) close(r->fd);
 }
 
-void traverseRL(struct readList *head){
-    struct readList *current = head;
-    while (current != NULL) {
-        printf("%s", current->data);
-        if (current->next != NULL){
-		    printf("|");
-        }
-        current = current->next;
+// sets up the rings and the provided buffer ring
+// returns -1 with errno set when the kernel is missing anything the engine relies on
+int uring_init(struct uring *r){
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    int needed[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CLOSE, IORING_OP_TIMEOUT };
+
+    memset(r, 0, sizeof(struct uring));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    r->fd = uring_setup(URING_ENTRIES, &p);
+    if (r->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
     }
-	printf("\n");
-
-    return;
-}
 
-void lengthRL(struct readList* head){
-    int length = 0;
-    struct readList *current = head;
-    while(current != NULL){
-        length++;
-        current = current->next;
+    probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        close(r->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        close(r->fd);
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+            free(probe);
+            close(r->fd);
+            errno = ENOSYS;
+            return -1;
+        }
+    }
+    free(probe);
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        uring_free(r);
+        return -1;
+    }
+    r->cq_ptr = r->sq_ptr;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        uring_free(r);
+        return -1;
     }
-    printf("%d", length);
-    return;
-}
 
-struct readList *freeRL(struct readList* head){
-    struct readList* sub;
-    while (head != NULL){
-        sub = head;
-        head = head->next;
-        free(sub->data);
-		sub->data = NULL;
-		free(sub);
-		sub = NULL;
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+    // provided buffer ring (5.19+, which also brings multishot accept)
+    r->br_len = URING_BUFFERS * sizeof(struct io_uring_buf);
+    r->br = mmap(NULL, r->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->br == MAP_FAILED) {
+        r->br = NULL;
+        uring_free(r);
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)r->br;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BGID;
+    if (uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_free(r);
+        return -1;
     }
-	return head;
+    r->bufs = malloc((size_t)URING_BUFFERS * BUFSIZE);
+    if (r->bufs == NULL) {
+        uring_free(r);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (unsigned short bid = 0; bid < URING_BUFFERS; bid++) {
+        uring_recycle(r, bid);
+    }
+    return 0;
 }
 
-char *makeWord(int wordSize, int runThrough, char *lineBuffer){
-	char *newWord = calloc(wordSize + 1, sizeof(char)); // +1 is to accomodate for '\0'
-	memmove(newWord, &lineBuffer[runThrough - wordSize], wordSize); // copy char into newWord
-    newWord[wordSize] = '\0';
-    return newWord;
+// pushes every queued submission to the kernel, optionally waiting for completions
+int uring_submit(struct uring *r, unsigned wait_nr){
+    int ret;
+    ret = uring_enter(r->fd, r->to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    r->enters++;
+    if (ret >= 0) {
+        r->submissions += ret;
+        r->to_submit -= ret;
+    }
+    return ret;
 }
 
-struct readList *turnToRL(int linePos, char *lineBuffer, struct readList *head){
-	int wordSize = 0;
-    int runThrough = 0;
-    int howManyPipes = 0;
-    if ((lineBuffer[runThrough] == '\n')){ //improper format - line is empty
-		// fputs("line is empty\n", stderr);
-		return head; //head will be NULL.
-	}   
-	if ((lineBuffer[runThrough] == '|')){ //improper format - | should not be the first character
-		// fputs("| should not be first character!\n", stderr);
-		return head; //head will be NULL.
-	} 
-
-    int noPipe = 0;
-    if ((lineBuffer[linePos - 2] != '|')){ // improper format - | should be the last character
-		noPipe = 1;
-    }
-	while ((runThrough < linePos - 1)){ //reads the first four characters
-		if (lineBuffer[runThrough] == '|'){
-            howManyPipes++;
-			//allocates size of thing before space
-			head = insertRL(makeWord(wordSize, runThrough, lineBuffer), head, wordSize);
-			wordSize = 0;
-		} else {
-            wordSize++;
+// returns a zeroed submission slot, flushing the queue first if it is full
+struct io_uring_sqe *uring_get_sqe(struct uring *r){
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    while (tail - head >= URING_ENTRIES) {
+        if (uring_submit(r, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
         }
-		runThrough++;
-	}
-    if ((runThrough == (linePos - 1)) && (noPipe == 1)){
-        head = insertRL(makeWord(wordSize, runThrough, lineBuffer), head, wordSize);
-        wordSize = 0;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
     }
-
-	return head;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
 }
 
-struct readList *turnToRLCompletely(int linePos, char *lineBuffer, struct readList *head){
-	int wordSize = 0;
-    int runThrough = 0;
-    if ((lineBuffer[runThrough] == '\n')){ //improper format - line is empty
-		// fputs("line is empty\n", stderr);
-		return head; //head will be NULL.
-	}   
-	if ((lineBuffer[runThrough] == '|')){ //improper format - | should not be the first character
-		// fputs("| should not be first character\n", stderr);
-		return head; //head will be NULL.
-	} 
-    if ((lineBuffer[linePos - 2] != '|')){ // improper format - | should be the last character
-		// fputs("| should be last character\n", stderr);
-		return head; //head will be NULL.
-    }
+// outbound queues: a reply goes straight to the socket when it has room, the rest waits in the
+// connection's queue and is flushed as the peer reads, so a slow peer never blocks whoever sends to it
+#define OUT_LOW 1024     // a stalled connection is read again once its queue drains to this
+#define OUT_HIGH 4096    // requests from a connection whose replies pile up past this have to wait
+#define OUT_LIMIT 65536  // a connection whose queue would grow past this gets the overflow policy
 
-	while ((runThrough < linePos)){ //reads the first four characters
-		if (lineBuffer[runThrough] == '|'){
-			//allocates size of thing before space
-			head = insertRL(makeWord(wordSize, runThrough, lineBuffer), head, wordSize);
-			wordSize = 0;
-		} else {
-            wordSize++;
-        }
-		runThrough++;
-	}
+// what happens to a player whose queue overflows, selectable with -o
+#define OVERFLOW_FORFEIT 0    // the game is lost by forfeit, the player still gets what was queued
+#define OVERFLOW_DISCONNECT 1 // the connection is dropped, the game ends as if it disconnected
+int overflowPolicy = OVERFLOW_FORFEIT;
 
-	return head;
+// the threaded engine is the only one where two threads touch the same queue
+void out_lock(struct connection_data *con){
+    if (engine == ENGINE_THREADS) pthread_mutex_lock(&con->outLock);
 }
 
+void out_unlock(struct connection_data *con){
+    if (engine == ENGINE_THREADS) pthread_mutex_unlock(&con->outLock);
+}
 
-struct Game *initGame(struct Game *head){
-    pthread_mutex_lock(&lock);
-    struct Game *sub = calloc(1, sizeof(struct Game));
-    sub->gameNumber = gameCount; // set game number
-    gameCount++;
-    sub->playerOne = 0;
-    sub->playerTwo = 1;
-    sub->next = NULL;
-    pthread_mutex_unlock(&lock);
-    head = sub;
-    return head; 
-}
-
-struct Game *insertGame(char *name, struct Game *head, int fd, int nameSize){
-    pthread_mutex_lock(&lock);
-    struct Game *current = head->next;
-    if (current == NULL){
-        // malloc the game
-        struct Game *sub = calloc(1, sizeof(struct Game));
-        sub->gameNumber = gameCount; // set game number
-        gameCount++;
-        sub->playerOne = fd;
-        char playerName[85];
-        strcpy(playerName, name);
-        sub->playerOneName = playerName;
-        sub->playerOneSize = nameSize;
-        sub->playerTwo = 0;
-        sub->draw = 0;
-        sub->olive = 0;
-        //playerTwoName will be empty
-        //playerTwoSize will be empty
-        char tttGrid[10];
-        for (int i = 0; i < 9; i++){
-            char letter = '.';
-            tttGrid[i] = letter;
-        }
-        tttGrid[9] = '\0';
-        sub->turn = 0;
-        sub->grid = tttGrid;
-        sub->next = NULL;
-        struct fdList *playerFd = searchFileList(fd);
-        playerFd->start = 1;
-        head->next = sub;
-        pthread_mutex_unlock(&lock);
-        return head; 
-    }
-    while (current->next != NULL){
-        current = current->next;
+// threaded engine: hands a connection (back) to the poller, which reports it once, see run_threads()
+// it watches for requests unless the connection is stalled, and for room while its queue is not empty
+// the caller holds the connection's out_lock
+int poll_arm(struct connection_data *con, int op){
+    struct epoll_event ev;
+
+    ev.events = EPOLLONESHOT | (con->stalled ? 0 : EPOLLIN | EPOLLRDHUP) | (con->outLen > 0 ? EPOLLOUT : 0);
+    ev.data.fd = con->fd; // not the pointer: a stale event must not reach a freed connection
+    con->polled = 1;
+    if (epoll_ctl(shard->epfd, op, con->fd, &ev) == -1) {
+        perror("epoll_ctl");
+        con->polled = 0;
+        return -1;
     }
-    if (current->playerTwo == 0){
-        current->playerTwo = fd;
-        current->playerTwoSize = nameSize;
-        char playerName[85];
-        strcpy(playerName, name);
-        current->playerTwoName = playerName;
-
-        //I changed this a bit since you only used it in BEGN, but when this runs, it displays the OPPONENT'S name.
-        char *opponentName = current->playerOneName;
-        int opponentSize = current->playerOneSize;
-        opponentSize = opponentSize + 3; //for the additional stuff "X| ... |"
-
-        char lengthOfRest[85];
-        sprintf(lengthOfRest, "%d", opponentSize);
-
-        char *begn = "BEGN|";
-        char *symbol = "|X|";
-        char *firstOpponent = opponentName;
-        char *lastBar = "|";
-
-        // printf("\n\n%s", begn);       
-        // printf("%s", lengthOfRest);
-        // printf("%s", symbol);
-        // printf("%s", firstOpponent);
-        // printf("%s\n", lastBar);
-
-        char reason[99];
-        strcpy(reason, begn);
-        strcat(reason, lengthOfRest);
-        strcat(reason, symbol);
-        strcat(reason, firstOpponent);
-        strcat(reason, lastBar);
-
-        write(current->playerOne, reason, strlen(reason));
-
-        //player Two
-        int otherSize = current->playerTwoSize;
-        char *otherName = current->playerTwoName;
-        otherSize = otherSize + 3;
-
-        char lengthOfRestTwo[85];
-        sprintf(lengthOfRestTwo, "%d", otherSize);
-
-        char *newSymbol = "|O|";
-        char *secondOpponent = otherName;
-
-        // printf("%s", begn);       
-        // printf("%s", lengthOfRestTwo);
-        // printf("%s", newSymbol);
-        // printf("%s", secondOpponent);
-        // printf("%s\n", lastBar);
-
-        char reasonTwo[99];
-        strcpy(reasonTwo, begn);
-        strcat(reasonTwo, lengthOfRestTwo);
-        strcat(reasonTwo, newSymbol);
-        strcat(reasonTwo, secondOpponent);
-        strcat(reasonTwo, lastBar);
-
-        struct fdList *playerFd = searchFileList(current->playerOne);
-        playerFd->ingame = 1;
-        playerFd->start = 0;
-        playerFd = searchFileList(current->playerTwo);
-        playerFd->ingame = 1;
-        playerFd->start = 0;
-
-        write(current->playerTwo, reasonTwo, strlen(reasonTwo));
-        pthread_mutex_unlock(&lock);
-        return head;
-    } else {
-        // malloc the game
-        struct Game *sub = calloc(1, sizeof(struct Game));
-        sub->gameNumber = gameCount; // set game number
-        gameCount++;
-        sub->playerOne = fd;
-        char playerName[85];
-        strcpy(playerName, name);
-        sub->playerOneName = playerName;
-        sub->playerOneSize = nameSize;
-        sub->playerTwo = 0;
-        sub->draw = 0;
-        sub->olive = 0;
-        //playerTwoName will be empty
-        //playerTwoSize will be empty
-        char tttGrid[10];
-        for (int i = 0; i < 9; i++){
-            char letter = '.';
-            tttGrid[i] = letter;
-        }
-        tttGrid[9] = '\0';
-        sub->turn = 0;
-        sub->grid = tttGrid;
-        sub->next = NULL;
-        struct fdList *playerFd = searchFileList(fd);
-        playerFd->start = 1;
-        current->next = sub;
-        pthread_mutex_unlock(&lock);
-        return head; 
-    }
-}
-
-void traverseGames(struct Game *head){
-    struct Game *current = head;
-    while (current != NULL) {
-        // puts("here?\n");
-        printf("game: %d, ", current->gameNumber);
-        printf("p1: %d, ", current->playerOne);
-        printf("p2: %d", current->playerTwo);
+    return 0;
+}
 
-        if (current->next != NULL){
-		    printf(" | ");
+// returns -1 if the queue could not grow, it is left as it was
+int out_append(struct connection_data *con, const char *msg, size_t len){
+    if (con->outLen + (int)len > con->outSize) {
+        int size = con->outSize ? con->outSize : BUFSIZE;
+        while (size < con->outLen + (int)len) size *= 2;
+        char *buf = realloc(con->outBuf, size);
+        if (buf == NULL) {
+            log_warn("peer=%s:%s event=queue error=\"no memory for replies\"", con->host, con->port);
+            return -1;
         }
-        current = current->next;
+        con->outBuf = buf;
+        con->outSize = size;
     }
-    printf("\n----------\n");
+    memcpy(con->outBuf + con->outLen, msg, len);
+    con->outLen += len;
+    return 0;
+}
 
-    return;
+void uring_send(struct uring *r, struct connection_data *con){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = con->fd;
+    sqe->addr = (unsigned long)(con->sendBuf + con->sendOff);
+    sqe->len = con->sendLen - con->sendOff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)con | URING_SEND;
+    con->sendBusy = 1;
+    con->writes++;
+    r->sends++;
 }
 
-struct Game *findGame(struct Game *head, int fd){
-    struct Game *current = head->next;
-    // searches for game
-    while (current != NULL){
-        if (fd == (current->playerOne)){
-            return current;
-        } else if (fd == (current->playerTwo)){
-            return current;
+// io_uring: sends everything queued with one SEND, unless one is still in flight
+// keeping a single send per connection keeps its replies in order without linking
+// them to the sends of other connections
+void uring_flush(struct uring *r, struct connection_data *con){
+    if (con->sendBusy || con->outLen == 0) return;
+
+    // swap the buffers, new replies queue up while this batch is sent
+    char *buf = con->sendBuf;
+    int size = con->sendSize;
+    con->sendBuf = con->outBuf;
+    con->sendSize = con->outSize;
+    con->sendLen = con->outLen;
+    con->sendOff = 0;
+    con->outBuf = buf;
+    con->outSize = size;
+    con->outLen = 0;
+    uring_send(r, con);
+}
+
+// a plain syscall even under io_uring: IORING_OP_SHUTDOWN runs on an io-wq worker and resolves
+// the descriptor only then, after the CLOSE queued behind it may have let another shard reuse it
+void shutdown_now(struct connection_data *con){
+    shutdown(con->fd, con->draining ? SHUT_WR : SHUT_RDWR);
+}
+
+// bytes queued for a connection, including a send in flight
+int out_pending(struct connection_data *con){
+    return con->outLen + (con->sendBusy ? con->sendLen - con->sendOff : 0);
+}
+
+// bookkeeping once part of the queue went out
+// returns 1 if a stalled connection may read requests again
+int out_drained(struct connection_data *con){
+    if (con->shutPending && out_pending(con) == 0) {
+        con->shutPending = 0;
+        shutdown_now(con);
+    }
+    if (con->stalled && out_pending(con) <= OUT_LOW) {
+        con->stalled = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// stops queueing for a connection whose queue overflowed
+// a player in a game forfeits it: the queue is kept and the game's actor ends the game once the
+// line that overflowed it has run, see game_forfeit(); anyone else is dropped, its reader sees EOF
+void out_overflow(struct connection_data *con){
+    struct Game *game = __atomic_load_n(&con->game, __ATOMIC_ACQUIRE);
+    int forfeit = overflowPolicy == OVERFLOW_FORFEIT && game != NULL;
+
+    log_warn("peer=%s:%s event=overflow action=%s", con->host, con->port, forfeit ? "forfeit" : "disconnect");
+    con->overflow = 1;
+    if (forfeit) {
+        __atomic_store_n(&game->forfeit, con, __ATOMIC_RELEASE);
+        return;
+    }
+    con->outLen = 0;
+    shutdown(con->fd, SHUT_RDWR);
+}
+
+// queues a reply, writing it right away when the socket has room
+void out_queue(struct connection_data *con, const char *msg, size_t len){
+    int wasEmpty;
+
+    out_lock(con);
+    if (con->overflow) {
+        out_unlock(con);
+        return;
+    }
+    if (con->corked) { // out_uncork() sends the whole batch
+        // a queue that cannot grow is treated like one that is full
+        if (con->outLen + (int)len > OUT_LIMIT || out_append(con, msg, len) == -1) {
+            out_overflow(con);
+        } else {
+            con->batchReplies++;
+            if (out_pending(con) > OUT_HIGH) con->stalled = 1;
+        }
+        out_unlock(con);
+        return;
+    }
+    wasEmpty = con->outLen == 0;
+    if (wasEmpty && shard->ring == NULL) {
+        ssize_t n = send(con->fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        con->writes++;
+        if (n > 0) stat_add(STAT_BYTES_OUT, n);
+        if (n == -1) { // anything but a full socket means it is broken, and its reader will notice
+            n = (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : (ssize_t)len;
+        }
+        msg += n;
+        len -= n;
+    }
+    if (len > 0) {
+        if (con->outLen + (int)len > OUT_LIMIT || out_append(con, msg, len) == -1) {
+            out_overflow(con);
+            out_unlock(con);
+            return;
+        }
+        if (shard->ring) uring_flush(shard->ring, con);
+        // epoll: the edge-triggered EPOLLOUT fires once the socket has room again
+    }
+    if (out_pending(con) > OUT_HIGH) con->stalled = 1;
+    // threaded engine: an idle connection's poller has to start watching for room too,
+    // a worker handling it rearms it once done
+    if (engine == ENGINE_THREADS && wasEmpty && con->outLen > 0 && con->polled) poll_arm(con, EPOLL_CTL_MOD);
+    out_unlock(con);
+}
+
+// queues a connection's last reply even though its queue overflowed, and shuts it down once that is out
+// the queue is not empty, so whatever is flushing it picks the reply up
+void out_last(struct connection_data *con, const char *msg, size_t len){
+    out_lock(con);
+    out_append(con, msg, len); // without memory for it, the player only sees the connection end
+    con->shutPending = 1;
+    if (shard->ring && !con->corked) uring_flush(shard->ring, con);
+    out_unlock(con);
+}
+
+// writes as much of the queue as the socket takes (threaded and epoll engines)
+// returns 1 if that got a stalled connection going again
+int out_flush(struct connection_data *con){
+    int off = 0, resumed;
+
+    out_lock(con);
+    while (off < con->outLen) {
+        ssize_t n = send(con->fd, con->outBuf + off, con->outLen - off, MSG_DONTWAIT | MSG_NOSIGNAL);
+        con->writes++;
+        if (n > 0) {
+            stat_add(STAT_BYTES_OUT, n);
+            off += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) { // broken, its reader will notice
+            off = con->outLen;
+        }
+    }
+    con->outLen -= off;
+    if (off > 0) memmove(con->outBuf, con->outBuf + off, con->outLen); // outBuf is NULL until the first reply queues
+    resumed = out_drained(con);
+    out_unlock(con);
+    return resumed;
+}
+
+// pipelining: while every request already buffered is handled, replies to the connection
+// (its own and those its opponent's moves cause) only queue up, in the order they were made
+void out_cork(struct connection_data *con){
+    out_lock(con);
+    con->corked = 1;
+    con->batchReplies = 0;
+    con->batchStart = con->writes;
+    out_unlock(con);
+}
+
+// ends a batch: everything it queued goes out with a single write
+void out_uncork(struct connection_data *con){
+    int replies;
+
+    out_lock(con);
+    con->corked = 0;
+    replies = con->batchReplies;
+    if (shard->ring) uring_flush(shard->ring, con);
+    out_unlock(con);
+    if (shard->ring == NULL) out_flush(con);
+
+    if (replies > 0) { // the threaded engine's connections share one shard
+        __atomic_fetch_add(&shard->batches, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->batchReplies, replies, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->batchWrites, con->writes - con->batchStart, __ATOMIC_RELAXED);
+    }
+}
+
+void out_free(struct connection_data *con){
+    free(con->outBuf);
+    free(con->sendBuf);
+    pthread_mutex_destroy(&con->outLock);
+}
+
+// sends a protocol message to a client through its outbound queue
+// the stripe lock keeps the connection from being freed while its queue is used
+ssize_t send_message(int fd, const char *msg, size_t len){
+    fd_lock(fd);
+    fdList *target = searchFileList(fd);
+    if (target == NULL || target->con == NULL) {
+        fd_unlock(fd);
+        return write(fd, msg, len);
+    }
+    out_queue(target->con, msg, len);
+    fd_unlock(fd);
+    return len;
+}
+
+// ends a connection from our side once its queue is flushed; its reader then sees EOF and cleans up
+void shutdown_peer(int fd){
+    fd_lock(fd);
+    fdList *target = searchFileList(fd);
+    if (target == NULL || target->con == NULL) {
+        shutdown(fd, SHUT_RDWR);
+    } else {
+        out_lock(target->con);
+        target->con->shutPending = 1;
+        out_drained(target->con);
+        out_unlock(target->con);
+    }
+    fd_unlock(fd);
+}
+
+// replies: CODE|length|payload, the payload is written first and the header right in front of it,
+// so lengths are counted rather than spelled out, and no reply is allocated or measured with strlen
+#define REPLY_HEAD 9  // room for "CODE|" and a length of up to 3 digits with its '|'
+#define REPLY_MAX 128 // the longest reply is an OVER carrying a 50-byte name
+
+struct reply {
+    char text[REPLY_MAX];
+    int start; // first byte of the finished message
+    int end;   // one past the last byte written
+};
+
+void reply_open(struct reply *r){
+    r->end = REPLY_HEAD;
+}
+
+// appends bytes to the payload as they are
+void reply_add(struct reply *r, const char *data, int size){
+    memcpy(r->text + r->end, data, size);
+    r->end += size;
+}
+
+// appends one field and the '|' closing it
+void reply_field(struct reply *r, const char *data, int size){
+    reply_add(r, data, size);
+    r->text[r->end++] = '|';
+}
+
+// writes CODE|length| in front of the payload
+void reply_close(struct reply *r, const char *code){
+    int at = REPLY_HEAD, n = r->end - REPLY_HEAD;
+    r->text[--at] = '|';
+    do {
+        r->text[--at] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    r->text[--at] = '|';
+    at -= 4;
+    memcpy(r->text + at, code, 4);
+    r->start = at;
+}
+
+void reply_send(int fd, const struct reply *r){
+    send_message(fd, r->text + r->start, r->end - r->start);
+}
+
+// for a connection already at hand, no need to look it up through send_message()
+void reply_queue(struct connection_data *con, const struct reply *r){
+    out_queue(con, r->text + r->start, r->end - r->start);
+}
+
+// code and payload of each, the payload's own '|' included
+const char *fixedText[REPLIES][2] = {
+    [REPLY_WAIT] = { "WAIT", "" },
+    [REPLY_DRAW_SUGGESTED] = { "DRAW", "S|" },
+    [REPLY_DRAW_REJECTED] = { "DRAW", "R|" },
+    [REPLY_INVALID_COMMAND] = { "INVL", "Invalid command|" },
+    [REPLY_INCORRECT_BYTES] = { "INVL", "Incorrect bytes|" },
+    [REPLY_NOT_A_NUMBER] = { "INVL", "Field two not a number|" },
+    [REPLY_CANNOT_MEASURE] = { "INVL", "Cannot measure size accurately|" },
+    [REPLY_MESSAGE_TOO_LONG] = { "INVL", "Message too long|" },
+    [REPLY_ALREADY_IN_GAME] = { "INVL", "Already in game|" },
+    [REPLY_NAME_TOO_LONG] = { "INVL", "Name's too long|" },
+    [REPLY_INVALID_OPPONENT] = { "INVL", "Invalid opponent|" },
+    [REPLY_UNKNOWN_GAME] = { "INVL", "Unknown game|" },
+    [REPLY_NAME_OCCUPIED] = { "INVL", "Name is occupied|" },
+    [REPLY_NOT_STARTED] = { "INVL", "Game hasn't started|" },
+    [REPLY_DRAW_WAS_CALLED] = { "INVL", "Draw was called|" },
+    [REPLY_WRONG_ROLE] = { "INVL", "Wrong role used|" },
+    [REPLY_WAIT_YOUR_TURN] = { "INVL", "Wait your turn!|" },
+    [REPLY_WRONG_SUB_BOARD] = { "INVL", "Wrong sub-board|" },
+    [REPLY_SPACE_OCCUPIED] = { "INVL", "Space occupied.|" },
+    [REPLY_DRAW_ALREADY_CALLED] = { "INVL", "Draw already called|" },
+    [REPLY_DRAW_NOT_CALLED] = { "INVL", "Draw not called|" },
+    [REPLY_NO_MOVES_LEFT] = { "OVER", "D|No moves left.|" },
+    [REPLY_DRAW_REACHED] = { "OVER", "D|A draw has been reached.|" },
+    [REPLY_OPPONENT_RESIGNED] = { "OVER", "W|Opponent has resigned|" },
+    [REPLY_OPPONENT_DISCONNECTED] = { "OVER", "W|Opponent disconnected|" },
+    [REPLY_OPPONENT_FORFEITED] = { "OVER", "W|Opponent forfeited|" },
+    [REPLY_TIMED_OUT] = { "INVL", "Timed out|" },
+    [REPLY_OUT_OF_TIME] = { "OVER", "L|Out of time|" },
+    [REPLY_OVERFLOWED] = { "OVER", "L|Too many unread replies|" },
+    [REPLY_SERVER_BUSY] = { "INVL", "Server busy|" },
+};
+
+struct reply fixedReplies[REPLIES];
+
+void replies_init(void){
+    for (int i = 0; i < REPLIES; i++) {
+        reply_open(&fixedReplies[i]);
+        reply_add(&fixedReplies[i], fixedText[i][1], strlen(fixedText[i][1]));
+        reply_close(&fixedReplies[i], fixedText[i][0]);
+    }
+}
+
+void send_fixed(int fd, int which){
+    stat_add(STAT_REPLY + which, 1);
+    reply_send(fd, &fixedReplies[which]);
+}
+
+// io_uring: keeps a closed connection around until its send completes
+// dead is 1 if the socket still has to be closed then, 2 if cleanup_fds() closes it
+void linger(struct connection_data *con, int dead){
+    con->dead = dead;
+    con->next = shard->lingering;
+    shard->lingering = con;
+}
+
+// closes a connection's socket; under io_uring a send still in flight finishes first
+void close_socket(struct connection_data *con){
+    if (shard->ring == NULL) {
+        close(con->fd);
+        return;
+    }
+    if (con->sendBusy) { // uring_send_done() closes it
+        linger(con, 1);
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(shard->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = con->fd;
+    sqe->user_data = URING_OTHER;
+}
+
+// releases a closed connection's state
+void session_free(struct connection_data *con){
+    if (con->dead) return; // still sending, uring_send_done() frees it
+    out_free(con);
+    obj_free(POOL_CONN, con);
+}
+
+// deadlines, in seconds, -T changes them; 0 turns one off
+int timeouts[TIMEOUTS] = { 60, 600, 30, 300 };
+const char *timeoutNames[TIMEOUTS] = { "handshake", "lobby", "line", "move" };
+
+// the threaded engine is the only one where several threads share a wheel
+void wheel_lock(void){
+    if (engine == ENGINE_THREADS) pthread_mutex_lock(&shard->wheel.lock);
+}
+
+void wheel_unlock(void){
+    if (engine == ENGINE_THREADS) pthread_mutex_unlock(&shard->wheel.lock);
+}
+
+// the tick the clock is at, ahead of the wheel's own until wheel_run() catches up
+unsigned long wheel_clock(struct wheel *w){
+    return (now_ns() - w->start) / (TIMER_TICK_MS * 1000000LL);
+}
+
+// files a timer in the slot for its distance from now, which is never behind now
+void wheel_place(struct wheel *w, struct timer *t){
+    unsigned long delta = t->expires - w->now;
+    int level = 0;
+
+    if (delta >= 1UL << (WHEEL_BITS * WHEEL_LEVELS)) t->expires = w->now + (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1))) level++;
+    struct timer **slot = &w->slots[level][(t->expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    t->next = *slot;
+    if (t->next != NULL) t->next->link = &t->next;
+    __atomic_store_n(&t->link, slot, __ATOMIC_RELAXED);
+    *slot = t;
+}
+
+void wheel_unlink(struct timer *t){
+    *t->link = t->next;
+    if (t->next != NULL) t->next->link = t->link;
+    __atomic_store_n(&t->link, NULL, __ATOMIC_RELAXED);
+}
+
+// whether a timer is running, without the wheel's lock: only for timers the caller alone starts
+int timer_running(struct timer *t){
+    return __atomic_load_n(&t->link, __ATOMIC_RELAXED) != NULL;
+}
+
+// (re)starts a connection's timer for the deadline cause, due timeouts[cause] seconds from now,
+// or stops it if that one is off; runs on the thread of the shard the connection is on
+void timer_set(struct connection_data *con, struct timer *t, int cause){
+    struct wheel *w = &shard->wheel;
+
+    wheel_lock();
+    if (t->link != NULL) {
+        wheel_unlink(t);
+        w->running--;
+    }
+    if (timeouts[cause] > 0 && !con->timersOff) {
+        t->con = con;
+        t->cause = cause;
+        // rounded up, a deadline never passes early
+        t->expires = wheel_clock(w) + timeouts[cause] * 1000L / TIMER_TICK_MS + 1;
+        wheel_place(w, t);
+        w->running++;
+    }
+    wheel_unlock();
+}
+
+void timer_stop(struct timer *t){
+    wheel_lock();
+    if (t->link != NULL) {
+        wheel_unlink(t);
+        shard->wheel.running--;
+    }
+    wheel_unlock();
+}
+
+// a connection being closed: its timers stop, and nothing may start them again
+void timers_off(struct connection_data *con){
+    wheel_lock();
+    con->timersOff = 1;
+    wheel_unlock();
+    timer_stop(&con->deadline);
+    timer_stop(&con->partial);
+}
+
+// a deadline passed: the player is told, and shut down once that is out like an opponent whose game
+// ended; its reader sees EOF, and a game it was in is lost by forfeit (see game_left())
+// called under the wheel's lock, which keeps the connection from being closed meanwhile
+void timer_expire(struct timer *t){
+    struct connection_data *con = t->con;
+    struct Game *game = __atomic_load_n(&con->game, __ATOMIC_ACQUIRE);
+    int reply = game != NULL && game->prev != NULL ? REPLY_OUT_OF_TIME : REPLY_TIMED_OUT;
+
+    if (con->draining) { // it had as long as a message gets to close, see too_long()
+        shutdown(con->fd, SHUT_RDWR);
+        return;
+    }
+    if (con->expired) return; // its other timer was due at the same time
+    out_lock(con);
+    int leaving = con->shutPending || con->overflow || con->closing;
+    out_unlock(con);
+    if (leaving) return;
+
+    log_info("peer=%s:%s event=timeout deadline=%s", con->host, con->port, timeoutNames[t->cause]);
+    stat_add(STAT_TIMEOUT + t->cause, 1);
+    __atomic_store_n(&con->expired, 1, __ATOMIC_RELEASE);
+    stat_add(STAT_REPLY + reply, 1);
+    reply_queue(con, &fixedReplies[reply]);
+    out_lock(con);
+    con->shutPending = 1;
+    out_drained(con);
+    out_unlock(con);
+}
+
+// runs the wheel up to the clock: at each tick, the slots of higher levels whose turn it is are
+// spread over the levels below, then every timer in level 0's slot expires
+void wheel_run(void){
+    struct wheel *w = &shard->wheel;
+    unsigned long to = wheel_clock(w);
+    struct timer *t;
+
+    wheel_lock();
+    if (w->running == 0 && w->now < to) w->now = to; // nothing to expire on the way
+    while (w->now < to) {
+        w->now++;
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if (w->now & ((1UL << (WHEEL_BITS * level)) - 1)) continue;
+            struct timer **slot = &w->slots[level][(w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+            while ((t = *slot) != NULL) {
+                wheel_unlink(t);
+                wheel_place(w, t);
+            }
+        }
+        struct timer **slot = &w->slots[0][w->now & (WHEEL_SLOTS - 1)];
+        while ((t = *slot) != NULL) {
+            wheel_unlink(t);
+            w->running--;
+            timer_expire(t);
+        }
+    }
+    wheel_unlock();
+}
+
+// per-move deadlines: of a game's players only the one it waits on has one running, and neither
+// once it is over; called whenever whose turn it is changes
+void game_clock(struct Game *game){
+    int players[2] = { game->playerOne, game->playerTwo };
+
+    for (int i = 0; i < 2; i++) {
+        fd_lock(players[i]);
+        fdList *node = searchFileList(players[i]);
+        if (node != NULL && node->con != NULL) {
+            if (game->prev != NULL && game->turn == i) timer_set(node->con, &node->con->deadline, TIMEOUT_MOVE);
+            else timer_stop(&node->con->deadline);
+        }
+        fd_unlock(players[i]);
+    }
+}
+
+// threaded engine: the poller blocks in epoll_wait() and the workers in the pool, so a thread of its own runs shard 0's wheel
+pthread_t tickerThread;
+int tickerStarted = 0;
+
+void *run_ticker(void *arg){
+    struct timespec tick = { 0, TIMER_TICK_MS * 1000000L };
+    (void)arg;
+
+    shard = &shards[0];
+    while (active) {
+        nanosleep(&tick, NULL);
+        wheel_run();
+    }
+    log_release();
+    return NULL;
+}
+
+// a field of the message being handled: a view into the connection's lineBuffer
+// the parser overwrites the '|' after each field with '\0', so data can be used as a string
+typedef struct readList{
+    char *data;
+	int size;
+    struct readList *next;
+}readList;
+
+__thread struct readList fieldViews[MAX_FIELDS]; // fields of the message the thread is handling
+
+// splits the line into views stored in fields (MAX_FIELDS of them), without copying
+// returns the first field, NULL if the line is malformed
+struct readList *turnToRL(int linePos, char *lineBuffer, struct readList *fields){
+	int wordSize = 0;
+    int runThrough = 0;
+    int count = 0;
+    if ((lineBuffer[runThrough] == '\n')){ //improper format - line is empty
+		return NULL;
+	}   
+	if ((lineBuffer[runThrough] == '|')){ //improper format - | should not be the first character
+		return NULL;
+	} 
+
+    int noPipe = 0;
+    if ((lineBuffer[linePos - 2] != '|')){ // improper format - | should be the last character
+		noPipe = 1;
+    }
+	while ((runThrough < linePos - 1) || (noPipe == 1 && runThrough == linePos - 1)){
+		if (lineBuffer[runThrough] == '|' || runThrough == linePos - 1){
+            if (count == MAX_FIELDS) return NULL;
+            fields[count].data = &lineBuffer[runThrough - wordSize];
+            fields[count].size = wordSize;
+            fields[count].next = NULL;
+            if (count > 0) fields[count - 1].next = &fields[count];
+            lineBuffer[runThrough] = '\0';
+            count++;
+			wordSize = 0;
+		} else {
+            wordSize++;
+        }
+		runThrough++;
+	}
+
+	return count > 0 ? fields : NULL;
+}
+
+// puts back the separators turnToRL() overwrote, for a line that turned out to be incomplete
+void restoreRL(struct readList *head, char *lineBuffer, int linePos){
+    for (struct readList *current = head; current != NULL; current = current->next) {
+        char *end = current->data + current->size;
+        *end = (end == &lineBuffer[linePos - 1]) ? '\n' : '|';
+    }
+}
+
+
+// records how long a player who just got a BEGN waited since PLAY
+void match_time(struct connection_data *con){
+    hist_add(&shard->matchTimes, now_ns() - con->playAt);
+}
+
+// the head of a stripe's game list
+struct Game *initGame(void){
+    struct Game *sub = obj_calloc(POOL_GAME);
+    if (sub == NULL) return NULL;
+    sub->gameNumber = -1;
+    sub->playerOne = 0;
+    sub->playerTwo = 1;
+    sub->prev = NULL;
+    sub->next = NULL;
+    return sub;
+}
+
+// starts the game of two paired players, whoever wrote play first is X
+// the game goes first in its stripe's list, so pairing costs the same however many games are running
+// called under pair_lock() of both players, with both connections still open
+// returns -1 if the game could not be allocated, see refuse_pair()
+int insertGame(struct connection_data *one, struct connection_data *two){
+    struct Game *sub = obj_calloc(POOL_GAME); // names and board live inside it, one allocation per game
+    if (sub == NULL) return -1;
+    if (one->variant != VARIANT_ULTIMATE && wideBoards && (sub->wide = obj_alloc(POOL_WIDE)) == NULL) {
+        obj_free(POOL_GAME, sub);
+        return -1;
+    }
+    sub->gameNumber = __atomic_fetch_add(&shard->gameCount, nshards, __ATOMIC_RELAXED); // set game number
+    stat_add(STAT_GAMES_STARTED, 1);
+    sub->playerOne = one->fd;
+    strcpy(sub->playerOneName, one->name);
+    sub->playerOneSize = one->nameSize;
+    sub->playerTwo = two->fd;
+    strcpy(sub->playerTwoName, two->name);
+    sub->playerTwoSize = two->nameSize;
+    sub->draw = 0;
+    sub->olive = 0;
+    sub->board.marks[0] = sub->board.marks[1] = 0;
+    sub->variant = one->variant;
+    if (sub->variant == VARIANT_ULTIMATE) {
+        ult_clear(&sub->ultimate);
+    } else if (wideBoards) {
+        wide_clear(sub->wide);
+    }
+    sub->turn = 0;
+    struct stripe *stripe = &shard->stripes[sub->gameNumber & (nstripes - 1)];
+    pthread_mutex_lock(&stripe->gamesLock);
+    sub->prev = stripe->games;
+    sub->next = stripe->games->next;
+    if (stripe->games->next != NULL) stripe->games->next->prev = sub;
+    stripe->games->next = sub;
+    pthread_mutex_unlock(&stripe->gamesLock);
+    // before any BEGN goes out: the threaded engine may handle a reply to it right away
+    sub->refs = 2;
+    one->yourFd->ingame = 1;
+    one->yourFd->start = 0;
+    two->yourFd->ingame = 1;
+    two->yourFd->start = 0;
+    // the owners read it without a lock to route their next line to the game's actor
+    __atomic_store_n(&one->game, sub, __ATOMIC_RELEASE);
+    __atomic_store_n(&two->game, sub, __ATOMIC_RELEASE);
+
+    //BEGN displays the OPPONENT'S name
+    struct reply begn;
+    reply_open(&begn);
+    reply_field(&begn, "X", 1);
+    reply_field(&begn, sub->playerTwoName, sub->playerTwoSize);
+    reply_close(&begn, "BEGN");
+    // both connections are known, no need to look them up through send_message()
+    reply_queue(one, &begn);
+
+    //player Two
+    reply_open(&begn);
+    reply_field(&begn, "O", 1);
+    reply_field(&begn, sub->playerOneName, sub->playerOneSize);
+    reply_close(&begn, "BEGN");
+    reply_queue(two, &begn);
+    __atomic_fetch_add(&shard->games, 1, __ATOMIC_RELAXED);
+    match_time(one);
+    match_time(two);
+    game_clock(sub);
+    return 0;
+}
+
+// two paired players whose game could not be allocated: both are told and shut down once that is out
+void refuse_pair(struct connection_data *one, struct connection_data *two){
+    log_warn("event=pair error=\"no memory for a game\"");
+    send_fixed(one->fd, REPLY_SERVER_BUSY);
+    send_fixed(two->fd, REPLY_SERVER_BUSY);
+    shutdown_peer(one->fd);
+    shutdown_peer(two->fd);
+}
+
+// takes a player who is leaving out of the waiting queue, its entry is freed by whoever pops it
+// called under the player's stripe lock
+void waiter_cancel(struct connection_data *con){
+    if (con->waiter == NULL) return;
+    con->waiter->cancelled = 1;
+    con->waiter = NULL;
+    shard_waiting(con->variant, -1);
+}
+
+// only more players handling PLAY at once than the queue has cells can fill it, they pair up shortly
+void waiter_push(struct waiter *w){
+    while (waitq_push(&shard->waitq[w->variant], w) == -1) sched_yield();
+}
+
+// pairs the players who have waited longest, two at a time, for as long as there are two
+// runs after every PLAY, so whoever completes a pair starts the game right away
+void pair_waiting(int variant){
+    struct waitq *q = &shard->waitq[variant];
+    struct waiter *one, *two;
+    int gone[2];
+
+    while (waitq_reserve(q, 2)) {
+        one = waitq_take(q);
+        two = waitq_take(q);
+
+        // a cancelled entry's descriptor may belong to someone else by now, locking its stripe is harmless
+        pair_lock(one->fd, two->fd);
+        gone[0] = one->cancelled;
+        gone[1] = two->cancelled;
+        if (!gone[0] && !gone[1]) {
+            one->con->waiter = two->con->waiter = NULL;
+            if (insertGame(one->con, two->con) == -1) refuse_pair(one->con, two->con);
+            shard_waiting(variant, -2);
+        }
+        pair_unlock(one->fd, two->fd);
+
+        if (!gone[0] && !gone[1]) {
+            free(one);
+            free(two);
+            continue;
+        }
+        // a player who left is dropped, the other one goes back in line
+        if (gone[0]) free(one);
+        else waiter_push(one);
+        if (gone[1]) free(two);
+        else waiter_push(two);
+    }
+}
+
+// dumps a shard's games, only on request: see dump_tables()
+void traverseGames(struct shard *s){
+    for (int i = 0; i < nstripes; i++) {
+        struct stripe *stripe = &s->stripes[i];
+        pthread_mutex_lock(&stripe->gamesLock);
+        for (struct Game *current = stripe->games->next; current != NULL; current = current->next) {
+            printf("shard=%d game=%d p1=%d p2=%d\n", s->index, current->gameNumber,
+                current->playerOne, current->playerTwo);
+        }
+        pthread_mutex_unlock(&stripe->gamesLock);
+    }
+
+    return;
+}
+
+// the log writer runs this on SIGUSR1, the tables are walked under their stripe locks
+void dump_tables(void){
+    printf("dump: %d shards\n", nshards);
+    for (int i = 0; i < nshards; i++) {
+        traverseFileDescriptors(&shards[i]);
+        traverseGames(&shards[i]);
+    }
+}
+
+// ends a game: unlinks it from its stripe's list and marks it over
+// the memory stays until both players have let go of it, see game_release()
+void deleteGame(struct Game *target){
+    if (target == NULL || target->prev == NULL) return;
+    struct stripe *stripe = &shard->stripes[target->gameNumber & (nstripes - 1)];
+    stat_add(STAT_GAMES_ENDED, 1);
+
+    pthread_mutex_lock(&stripe->gamesLock);
+    target->prev->next = target->next;
+    if (target->next != NULL) target->next->prev = target->prev;
+    target->prev = target->next = NULL;
+    pthread_mutex_unlock(&stripe->gamesLock);
+}
+
+// the player lets go of its game, whoever does so last frees it
+void game_release(struct connection_data *con){
+    struct Game *target = con->game;
+    if (target == NULL) return;
+    con->game = NULL;
+    if (__atomic_sub_fetch(&target->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    deleteGame(target); // still running only if the server is shutting down
+    obj_free(POOL_WIDE, target->wide);
+    obj_free(POOL_GAME, target);
+}
+
+int isNumber(const char* str) {
+    if (str == NULL || *str == '\0') {
+        return 0; // empty string or null pointer
+    }
+    while (*str != '\0') {
+        if (!isdigit(*str)) {
+            return 0; // non-digit character found
+        }
+        str++;
+    }
+    return 1;
+}
+
+// results of handling one newline-terminated message
+#define MSG_CLOSED 0    // connection (and its game, if any) has been torn down
+#define MSG_OK 1        // message handled, keep reading
+#define MSG_NEED_MORE 2 // the declared length runs past this line, keep buffering
+#define MSG_MOVED 3     // the connection is being handed to another shard (con->moving)
+
+// picks the shard a player who sent PLAY should be paired on
+// a player without a partner here goes to the advertised shard, or advertises this one
+struct shard *pick_shard(int variant){
+    if (nshards == 1 || __atomic_load_n(&shard->waiting[variant], __ATOMIC_ACQUIRE) > 0) return shard;
+
+    int target = -1;
+    if (__atomic_compare_exchange_n(&lobby[variant], &target, shard->index, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return shard;
+    }
+    if (target == shard->index) return shard;
+    return &shards[target];
+}
+
+// pairs a player who named its opponent with that opponent, if it is already waiting for this player,
+// and leaves it waiting for the opponent otherwise; challenges never go through the open queue
+// returns 1 if the player has to move to the opponent's shard (con->moving) first
+int challenge(struct connection_data *con){
+    int other = con->fd;
+
+    for (;;) {
+        // the opponent's stripe comes before the registry in the lock order: look its descriptor up,
+        // lock both stripes, then check nothing changed in between
+        pair_lock(con->fd, other);
+        pthread_mutex_lock(&names.lock);
+        struct name *rival = names_find(con->rival, con->rivalSize);
+        if (rival == NULL || rival->home == NULL || strcmp(rival->con->rival, con->name) != 0
+                || rival->con->variant != con->variant) {
+            con->entry->home = shard;
+        } else if (rival->home != shard) {
+            con->moving = rival->home;
+            shard->handoffsOut++;
+        } else if (rival->con->fd != other) {
+            int fd = rival->con->fd;
+            pthread_mutex_unlock(&names.lock);
+            pair_unlock(con->fd, other);
+            other = fd;
+            continue;
+        } else {
+            rival->home = NULL;
+            if (insertGame(rival->con, con) == -1) refuse_pair(rival->con, con);
+            else __atomic_fetch_add(&shard->challenges, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&names.lock);
+        pair_unlock(con->fd, other);
+        return con->moving != NULL;
+    }
+}
+
+// puts a player who sent PLAY in this shard's waiting queue and pairs whoever is waiting
+// returns 1 instead if the player has to move to con->moving first, -1 if it could not be queued
+int joinGame(struct connection_data *con){
+    con->yourFd->start = 1;
+    if (con->rivalSize > 0) return challenge(con);
+
+    struct shard *target = pick_shard(con->variant);
+    if (target != shard) {
+        con->moving = target;
+        shard->handoffsOut++;
+        return 1;
+    }
+
+    struct waiter *w = malloc(sizeof(struct waiter));
+    if (w == NULL) {
+        con->yourFd->start = 0;
+        return -1;
+    }
+    w->con = con;
+    w->fd = con->fd;
+    w->cancelled = 0;
+    w->variant = con->variant;
+    con->waiter = w;
+    shard_waiting(con->variant, 1);
+    waiter_push(w);
+    pair_waiting(con->variant);
+    return 0;
+}
+
+// the other player of a game
+int opponent(struct connection_data *con, struct Game *game){
+    return con->fd == game->playerOne ? game->playerTwo : game->playerOne;
+}
+
+// ends a game both players have been told about: both connections are finished, and the
+// opponent's is shut down once its last reply is out
+void game_end(struct connection_data *con, struct Game *game){
+    int other = opponent(con, game);
+    fdList *otherFd = searchFileList(other);
+    pair_lock(con->fd, other);
+    con->yourFd->finished = 1;
+    otherFd->finished = 1;
+    deleteGame(game);
+    pair_unlock(con->fd, other);
+    game_clock(game);
+    shutdown_peer(other);
+}
+
+// a malformed or out-of-place message: the player is disconnected, and resigns the game it is in
+int reject(struct connection_data *con, struct Game *game, int reply){
+    send_fixed(con->fd, reply);
+    if (con->yourFd->ingame == 1 && game != NULL){
+        send_fixed(opponent(con, game), REPLY_OPPONENT_RESIGNED);
+        game_end(con, game);
+    } else { //not in a game
+        fd_lock(con->fd);
+        con->yourFd->finished = 1;
+        fd_unlock(con->fd);
+    }
+    con->linePos = 0;
+    return MSG_CLOSED;
+}
+
+// a mistake the player may correct, it stays connected
+int refuse(struct connection_data *con, int reply){
+    send_fixed(con->fd, reply);
+    con->linePos = 0;
+    return MSG_OK;
+}
+
+// a PLAY that could not be queued: the player is back where it was before it and may send it again
+// the WAIT it already got is followed by INVL
+int unplay(struct connection_data *con){
+    fd_lock(con->fd);
+    names_release(con);
+    fd_unlock(con->fd);
+    con->ingame = 0;
+    con->searching = 0;
+    timer_set(con, &con->deadline, TIMEOUT_HANDSHAKE);
+    return refuse(con, REPLY_SERVER_BUSY);
+}
+
+// command handlers: args is the first field after the length, their number is already checked,
+// and so is whether the player is in a game
+
+// PLAY -> 10 -> Joe Smith -> NULL
+int cmd_play(struct connection_data *con, struct Game *game, readList *args){
+    (void)game;
+    if (args->size > 50){ // err - name too long
+        return refuse(con, REPLY_NAME_TOO_LONG);
+    }
+
+    // optional second argument: the one player to be paired with
+    // optional third argument: the game, T for tic-tac-toe or U for ultimate; with it the second may be empty
+    readList *rival = args->next;
+    readList *variant = rival != NULL ? rival->next : NULL;
+    if (rival != NULL && variant != NULL && rival->size == 0) rival = NULL; // open match for that game
+    if (rival != NULL && (rival->size == 0 || rival->size > 50 || strcmp(rival->data, args->data) == 0)){
+        return refuse(con, REPLY_INVALID_OPPONENT);
+    }
+    if (variant != NULL && (variant->size != 1 || (variant->data[0] != 'T' && variant->data[0] != 'U'))){
+        return refuse(con, REPLY_UNKNOWN_GAME);
+    }
+
+    strcpy(con->name, args->data);
+    con->nameSize = args->size;
+    int claimed = names_claim(con);
+    if (claimed == -1){
+        log_warn("peer=%s:%s event=play error=\"no memory for a name\"", con->host, con->port);
+        return refuse(con, REPLY_SERVER_BUSY);
+    }
+    if (claimed == 0){
+        return refuse(con, REPLY_NAME_OCCUPIED);
+    }
+    con->rivalSize = 0;
+    if (rival != NULL) {
+        strcpy(con->rival, rival->data);
+        con->rivalSize = rival->size;
+    }
+    con->variant = variant != NULL && variant->data[0] == 'U' ? VARIANT_ULTIMATE : VARIANT_STANDARD;
+
+    con->ingame = 1;
+    con->searching = 1;
+    con->playAt = now_ns();
+
+    //everything looks all set? then execute play.
+    send_fixed(con->fd, REPLY_WAIT);
+    timer_set(con, &con->deadline, TIMEOUT_LOBBY); // before joinGame(), pairing starts the move clock
+    // no waiting here: whoever pairs the player queues its BEGN, which wakes the
+    // connection's owner (through the poller in the threaded engine)
+    int joined = joinGame(con);
+    if (joined == -1) return unplay(con);
+    if (joined == 1) { // the opponent is on another shard
+        return MSG_MOVED;
+    }
+    return MSG_OK;
+}
+
+//MOVE -> 6 -> X -> 2,2 -> NULL
+int cmd_move(struct connection_data *con, struct Game *currentGame, readList *args){
+    if (currentGame->draw != 0) { // err - draw was called, what are you doing brother
+        return refuse(con, REPLY_DRAW_WAS_CALLED);
+    }
+    con->searching = 0;
+
+    // is it just one character (the mark)?
+    // check to see if the string given is either X or O
+    char mark = args->data[0];
+    int remember; //0 if X, 1 if O
+    if (strcmp("X", args->data) == 0){
+        remember = 0;
+    } else if (strcmp("O", args->data) == 0){
+        remember = 1;
+    } else { // err - neither X nor O
+        return reject(con, currentGame, REPLY_INVALID_COMMAND);
+    }
+
+    //ensures the right player is moving, the makes sure they're using the right mark
+    if ((currentGame->turn == 0) && (con->fd == currentGame->playerOne)) {
+        if (remember == 1) { // err - wrong mark. O when should be X
+            return refuse(con, REPLY_WRONG_ROLE);
+        }
+    } else if ((currentGame->turn == 1) && (con->fd == currentGame->playerTwo)) {
+        if (remember == 0) { // err - wrong mark. X when should be O
+            return refuse(con, REPLY_WRONG_ROLE);
+        }
+    } else { //wrong player
+        return refuse(con, REPLY_WAIT_YOUR_TURN);
+    }
+
+    //we need the exact coords of where the move is being made
+    readList *coords = args->next;
+    int cell, row, col; // on ultimate boards row is the small board, col the cell in it
+    int ultimate = currentGame->variant == VARIANT_ULTIMATE;
+    if (ultimate) cell = ult_cell(coords->data, coords->size, &row, &col);
+    else if (currentGame->wide != NULL) cell = wide_cell(coords->data, coords->size, &row, &col);
+    else cell = board_cell(coords->data, coords->size);
+    if (cell == -1){ // err - needs to be r,c with both between 1 and the board's side
+        return reject(con, currentGame, REPLY_INVALID_COMMAND);
+    }
+
+    //the very last check! ensure there isn't a mark where the move is being made
+    //everything looks all set? then execute move.
+    int taken, ultWon = 0;
+    if (ultimate) {
+        taken = ult_legal(&currentGame->ultimate, row, col);
+        if (taken == ULT_ELSEWHERE) { // err - the last move sent this player to another small board
+            return refuse(con, REPLY_WRONG_SUB_BOARD);
+        }
+        if (taken == 0) ultWon = ult_play(&currentGame->ultimate, remember, row, col);
+    }
+    else if (currentGame->wide != NULL) taken = wide_play(currentGame->wide, remember, row, col);
+    else taken = board_play(&currentGame->board, remember, cell);
+    if (taken == -1) { // err - space is occupied
+        return refuse(con, REPLY_SPACE_OCCUPIED);
+    }
+    //now the server has to reply to both with the move made
+    struct reply movd;
+    reply_open(&movd);
+    reply_field(&movd, &mark, 1);
+    reply_field(&movd, coords->data, coords->size);
+    if (currentGame->wide == NULL && !ultimate) { // elsewhere only the move: a 15×15 board is 225 bytes, clients keep their own
+        char grid[BOARD_CELLS + 1];
+        board_render(&currentGame->board, grid);
+        reply_field(&movd, grid, BOARD_CELLS);
+        log_debug("game=%d board=%s", currentGame->gameNumber, grid);
+    }
+    reply_close(&movd, "MOVD");
+
+    //writes the updated position
+    reply_send(con->fd, &movd);
+    reply_send(opponent(con, currentGame), &movd);
+
+    //who won?
+    int over; //only the player who just moved can have won
+    if (ultimate) over = ultWon;
+    else if (currentGame->wide != NULL) over = wide_won(currentGame->wide, remember, row, col);
+    else over = board_won(&currentGame->board, remember);
+    if (over == 1) { //if the game is over
+        //con->fd is the winner
+        struct reply winReason, lossReason;
+        const char *winnerName = currentGame->playerOneName;
+        int winnerSize = currentGame->playerOneSize;
+        if (currentGame->playerTwo == con->fd){
+            winnerName = currentGame->playerTwoName;
+            winnerSize = currentGame->playerTwoSize;
+        }
+        reply_open(&winReason);
+        reply_field(&winReason, "W", 1);
+        reply_add(&winReason, winnerName, winnerSize);
+        reply_field(&winReason, " has won.", 9);
+        reply_close(&winReason, "OVER");
+        reply_open(&lossReason);
+        reply_field(&lossReason, "L", 1);
+        reply_add(&lossReason, winnerName, winnerSize);
+        reply_field(&lossReason, " has won.", 9);
+        reply_close(&lossReason, "OVER");
+        log_info("game=%d result=win winner=%.*s", currentGame->gameNumber, winnerSize, winnerName);
+        reply_send(con->fd, &winReason);
+        reply_send(opponent(con, currentGame), &lossReason);
+        game_end(con, currentGame);
+        con->ingame = 0;
+        return MSG_CLOSED;
+    }
+    //now we need to know if the game should end by default due to no more possible moves existing
+    if (ultimate ? ult_full(&currentGame->ultimate)
+            : currentGame->wide != NULL ? wide_full(currentGame->wide) : board_full(&currentGame->board)) {
+        send_fixed(con->fd, REPLY_NO_MOVES_LEFT);
+        send_fixed(opponent(con, currentGame), REPLY_NO_MOVES_LEFT);
+        game_end(con, currentGame);
+        con->ingame = 0;
+        return MSG_CLOSED;
+    }
+
+    //should probably alternate the turns once all of this is done too, teehee
+    if (currentGame->turn == 0) {
+        currentGame->turn = 1;
+    } else {
+        currentGame->turn = 0;
+    }
+    return MSG_OK;
+}
+
+// RSGN Indicates that the player has resigned.
+// The server will respond with OVER.
+
+//RSGN -> NULL
+int cmd_rsgn(struct connection_data *con, struct Game *currentGame, readList *args){
+    (void)args;
+    if (currentGame->draw != 0) { // err - draw was called, what are you doing brother
+        return refuse(con, REPLY_DRAW_WAS_CALLED);
+    }
+    con->searching = 0;
+
+    //send the resign function to both file descriptors
+    //we need to know WHO lost exactly
+
+    struct reply winReason, lossReason;
+    const char *loserName = currentGame->playerOneName;
+    int loserSize = currentGame->playerOneSize;
+    if (currentGame->playerTwo == con->fd){
+        loserName = currentGame->playerTwoName;
+        loserSize = currentGame->playerTwoSize;
+    }
+    reply_open(&winReason);
+    reply_field(&winReason, "L", 1);
+    reply_add(&winReason, loserName, loserSize);
+    reply_field(&winReason, " resigned.", 10);
+    reply_close(&winReason, "OVER");
+    reply_open(&lossReason);
+    reply_field(&lossReason, "W", 1);
+    reply_add(&lossReason, loserName, loserSize);
+    reply_field(&lossReason, " resigned.", 10);
+    reply_close(&lossReason, "OVER");
+
+    reply_send(con->fd, &winReason);
+    //the message sent to the winner (by default) is slightly different with the W instead of the L
+    reply_send(opponent(con, currentGame), &lossReason);
+    game_end(con, currentGame);
+    con->ingame = 0;
+    return MSG_CLOSED;
+}
+
+// DRAW Depending on the message, this indicates that the player is suggesting a draw (S), or is
+// accepting (A) or rejecting (R) a draw proposed by their opponent.
+// Note that DRAW A or DRAW R can only be sent in response to receiving a DRAW S from the server.
+
+// DRAW -> 2 -> S -> NULL
+int cmd_draw(struct connection_data *con, struct Game *currentGame, readList *args){
+    con->searching = 0;
+    if ((currentGame->turn == 1) && (con->fd == currentGame->playerOne)) {
+        return refuse(con, REPLY_WAIT_YOUR_TURN);
+    } else if ((currentGame->turn == 0) && (con->fd == currentGame->playerTwo)) {
+        return refuse(con, REPLY_WAIT_YOUR_TURN);
+    }
+
+    //is draw even being used right?
+    if (strcmp("S", args->data) == 0){
+        if (currentGame->draw == 0) { //draw had not been called yet
+            currentGame->draw = 1;
+            //sends request to other player
+            send_fixed(opponent(con, currentGame), REPLY_DRAW_SUGGESTED);
+            currentGame->olive = con->fd;
+            if (currentGame->turn == 0) {
+                currentGame->turn = 1;
+            } else {
+                currentGame->turn = 0;
+            }
+        } else { // error - can't send draw when you have to send either A or R.
+            return refuse(con, REPLY_DRAW_ALREADY_CALLED);
+        }
+         //draw had been called
+    } else if (strcmp("A", args->data) == 0 || strcmp("R", args->data) == 0) {
+        //execute draw
+        if (currentGame->draw == 0) { //error - draw had not been called yet
+            return refuse(con, REPLY_DRAW_NOT_CALLED);
+        } else { //draw had been called
+            if (strcmp("A", args->data) == 0) { //the draw was accepted
+                send_fixed(con->fd, REPLY_DRAW_REACHED);
+                send_fixed(opponent(con, currentGame), REPLY_DRAW_REACHED);
+                game_end(con, currentGame);
+                con->ingame = 0;
+                return MSG_CLOSED;
+            } else { //the draw was denied
+                send_fixed(currentGame->olive, REPLY_DRAW_REJECTED);
+                currentGame->olive = con->fd;
+                if (currentGame->turn == 0) {
+                    currentGame->turn = 1;
+                } else {
+                    currentGame->turn = 0;
+                }
+            }
+            currentGame->draw = 0;
+            currentGame->olive = 0;
+        }
+    } else {
+        return reject(con, currentGame, REPLY_INVALID_COMMAND);
+    }
+    return MSG_OK;
+}
+
+// every command, indexed by CMD_*; a message's first field is looked up by its 4 bytes as one integer
+struct command {
+    char opcode[5];
+    int minArgs;        // fields after the length, at least
+    int maxArgs;        // and at most, more or fewer is an invalid command
+    int inGame;         // 1 if the player has to be in a game, 0 if it must not be in one
+    int notReady;       // the reply otherwise
+    int notReadyCloses; // 1 if that also ends the connection
+    int (*run)(struct connection_data *con, struct Game *game, readList *args);
+    uint32_t key;       // the opcode's bytes, set by commands_init()
+};
+
+struct command commands[COMMANDS] = {
+    [CMD_PLAY] = { "PLAY", 1, 3, 0, REPLY_ALREADY_IN_GAME, 0, cmd_play, 0 },
+    [CMD_MOVE] = { "MOVE", 2, 2, 1, REPLY_NOT_STARTED, 0, cmd_move, 0 },
+    [CMD_RSGN] = { "RSGN", 0, 0, 1, REPLY_INVALID_COMMAND, 1, cmd_rsgn, 0 },
+    [CMD_DRAW] = { "DRAW", 1, 1, 1, REPLY_INVALID_COMMAND, 1, cmd_draw, 0 },
+};
+
+// open addressing on the opcode's integer, so a lookup is a multiply, a shift and usually one compare
+#define COMMAND_SLOTS 16 // must be a power of 2 and well above COMMANDS
+int commandSlots[COMMAND_SLOTS]; // index into commands plus 1, 0 for an empty slot
+
+unsigned command_slot(uint32_t key){
+    return (key * 2654435761u) >> 28;
+}
+
+void commands_init(void){
+    for (int i = 0; i < COMMANDS; i++) {
+        memcpy(&commands[i].key, commands[i].opcode, 4);
+        unsigned slot = command_slot(commands[i].key);
+        while (commandSlots[slot] != 0) slot = (slot + 1) & (COMMAND_SLOTS - 1);
+        commandSlots[slot] = i + 1;
+    }
+}
+
+// the command named by a message's first field, NULL for anything else
+struct command *command_find(const char *data, int size){
+    uint32_t key;
+
+    if (size != 4) return NULL;
+    memcpy(&key, data, 4);
+    for (unsigned slot = command_slot(key); commandSlots[slot] != 0; slot = (slot + 1) & (COMMAND_SLOTS - 1)) {
+        struct command *cmd = &commands[commandSlots[slot] - 1];
+        if (cmd->key == key) return cmd;
+    }
+    return NULL;
+}
+
+// processes the message sitting in con->lineBuffer
+// shared by the threaded and event-driven engines, so it must never block on the socket
+// game is the player's game when its actor runs this, NULL for a player not paired yet
+int handle_line(struct connection_data *con, struct Game *game){
+	readList *list = NULL;
+    long long cpuStart = cpu_ns();
+
+    int runThrough = 0;
+    int howManyPipes = 0;
+    while ((runThrough < con->linePos - 1)){ //reads the first four characters
+        if (con->lineBuffer[runThrough] == '|'){
+            howManyPipes++;
+        }
+        runThrough++;
+    }
+
+    log_debug("fd=%d line=%.*s", con->fd, con->linePos - 1, con->lineBuffer);
+    list = turnToRL(con->linePos, con->lineBuffer, fieldViews);
+    if (howManyPipes < 2){
+        return reject(con, game, REPLY_CANNOT_MEASURE);
+    }
+
+    if (list == NULL || list->next == NULL){
+        return reject(con, game, REPLY_INVALID_COMMAND);
+    }
+
+    // checks if it was a complete message
+    readList *fieldTwo = list->next;
+    int fieldChecker = isNumber(fieldTwo->data);
+    int fieldNumber = 0;
+    int firstTwoFields;
+    if (fieldChecker == 1){ // it's a number
+        fieldNumber = atoi(fieldTwo->data);
+        firstTwoFields = fieldTwo->size + 6;
+        fieldNumber = fieldNumber + firstTwoFields; //what the byte length should be
+        if (fieldNumber > (con->linePos - 1)){ // the newline was part of the message, wait for the rest of it
+            restoreRL(list, con->lineBuffer, con->linePos);
+            return MSG_NEED_MORE;
+        } else if (fieldNumber < (con->linePos - 1)){ // size is smaller - kill the program
+            return reject(con, game, REPLY_INCORRECT_BYTES);
+        }
+    } else { // err - not a number
+        return reject(con, game, REPLY_NOT_A_NUMBER);
+    }
+
+    readList *findLength = list;
+    findLength = findLength->next->next; //name->length->next args
+
+    int listLength = 0;
+    int args = 0;
+    while (findLength != NULL){
+        listLength = listLength + findLength->size + 1;
+        findLength = findLength->next;
+        args++;
+    }
+
+/////////////////// CHECK THE SECOND FIELD. ///////////////////
+    int fieldTwoNumber = atoi(fieldTwo->data);
+    if ((fieldTwoNumber < listLength) || (fieldTwoNumber > listLength)){ // err - the length is wrong.
+        return reject(con, game, REPLY_INCORRECT_BYTES);
+    }
+
+    struct command *cmd = command_find(list->data, list->size);
+    stat_add(STAT_COMMAND + (cmd != NULL ? cmd - commands : COMMANDS), 1);
+    if (cmd == NULL){ // err - not a valid command
+        return reject(con, game, REPLY_INVALID_COMMAND);
+    }
+    if (cmd->inGame ? (con->ingame == 0 || game == NULL) : con->ingame == 1){
+        if (cmd->notReadyCloses) return reject(con, game, cmd->notReady);
+        return refuse(con, cmd->notReady);
+    }
+    if (args < cmd->minArgs || args > cmd->maxArgs){ // err - wrong number of fields
+        return reject(con, game, REPLY_INVALID_COMMAND);
+    }
+
+    int which = cmd - commands;
+    long long parsed = now_ns();
+    stat_latency(which, LAT_PARSE, parsed - con->readAt);
+    int turn = game != NULL ? game->turn : -1;
+    int result = cmd->run(con, game, list->next->next);
+    if (game != NULL && game->turn != turn) game_clock(game);
+    long long updated = now_ns();
+    stat_latency(which, LAT_UPDATE, updated - parsed);
+    stat_latency(which, LAT_CPU, cpu_ns() - cpuStart);
+    if (con->timedLines < TIMED_LINES) { // its write is timed once the batch is out
+        con->timedCmd[con->timedLines] = which;
+        con->timedAt[con->timedLines++] = updated;
+    }
+    con->linePos = 0;
+    return result;
+}
+
+// appends up to len bytes to the input buffer, returns how many fit
+int appendLine(struct connection_data *con, char *buf, int len){
+    int room = LINE_CAP - con->lineLen;
+    if (len > room) len = room;
+    memcpy(con->lineBuffer + con->lineLen, buf, len);
+    con->lineLen += len;
+    return len;
+}
+
+// a player disconnected in the middle of its game: the opponent wins, by forfeit if the player was
+// dropped for not reading its replies or for missing a deadline
+// runs on the game's actor like the players' lines
+void game_left(struct connection_data *con, struct Game *currentGame){
+    if (currentGame->prev == NULL) return; // the game ended first
+
+    int why = STAT_LEFT;
+    if (con->overflow && overflowPolicy == OVERFLOW_FORFEIT) why = STAT_OVERFLOWED;
+    if (__atomic_load_n(&con->expired, __ATOMIC_ACQUIRE)) why = STAT_EXPIRED;
+    int whatHappened = why == STAT_LEFT ? REPLY_OPPONENT_DISCONNECTED : REPLY_OPPONENT_FORFEITED;
+    stat_add(why, 1);
+    fdList *otherFd;
+    log_info("game=%d result=%s fd=%d", currentGame->gameNumber,
+        whatHappened == REPLY_OPPONENT_FORFEITED ? "forfeit" : "disconnect", con->fd);
+    if (con->fd == currentGame->playerOne) {
+        send_fixed(currentGame->playerTwo, whatHappened);
+        otherFd = searchFileList(currentGame->playerTwo);
+    } else { //con->fd is player Two
+        send_fixed(currentGame->playerOne, whatHappened);
+        otherFd = searchFileList(currentGame->playerOne);
+    }
+    pair_lock(con->fd, otherFd->fileDescriptor);
+    otherFd->finished = 1;
+    deleteGame(currentGame);
+    pair_unlock(con->fd, otherFd->fileDescriptor);
+    game_clock(currentGame);
+    shutdown_peer(otherFd->fileDescriptor);
+}
+
+// a player's replies overflowed during the last line (-o forfeit): it gets OVER L after what was
+// already queued and the opponent OVER W; the opponent is finished like at the end of any game,
+// the player is kept until its reader sees EOF, which comes once everything queued is out
+void game_forfeit(struct Game *game){
+    struct connection_data *con = game->forfeit;
+    struct reply *lost = &fixedReplies[REPLY_OVERFLOWED];
+    int other = opponent(con, game);
+    fdList *otherFd = searchFileList(other);
+
+    game->forfeit = NULL;
+    stat_add(STAT_OVERFLOWED, 1);
+    log_info("game=%d result=forfeit fd=%d", game->gameNumber, con->fd);
+    stat_add(STAT_REPLY + REPLY_OVERFLOWED, 1);
+    out_last(con, lost->text + lost->start, lost->end - lost->start);
+    send_fixed(other, REPLY_OPPONENT_FORFEITED);
+    pair_lock(con->fd, other);
+    otherFd->finished = 1;
+    deleteGame(game);
+    pair_unlock(con->fd, other);
+    game_clock(game);
+    shutdown_peer(other);
+}
+
+// runs everything posted to the game so far, oldest first, mine included
+// only the thread that set game->running calls this
+void actor_drain(struct Game *game, struct gamemsg *mine){
+    struct gamemsg *list, *msg, *next;
+
+    while ((list = __atomic_exchange_n(&game->mailbox, NULL, __ATOMIC_ACQUIRE)) != NULL) {
+        struct gamemsg *oldest = NULL;
+        for (; list != NULL; list = next) {
+            next = list->next;
+            list->next = oldest;
+            oldest = list;
+        }
+        __atomic_fetch_add(&shard->actorRuns, 1, __ATOMIC_RELAXED);
+        for (msg = oldest; msg != NULL; msg = next) {
+            next = msg->next; // msg is gone once its poster sees done
+            if (msg->left) {
+                game_left(msg->con, game);
+                msg->result = MSG_CLOSED;
+            } else if (game->prev == NULL) { // ended by the line before, the player is finished too
+                msg->result = MSG_CLOSED;
+            } else {
+                msg->result = handle_line(msg->con, game);
+            }
+            if (game->prev != NULL && __atomic_load_n(&game->forfeit, __ATOMIC_ACQUIRE) != NULL) game_forfeit(game);
+            __atomic_fetch_add(&shard->actorLines, 1, __ATOMIC_RELAXED);
+            if (msg != mine) __atomic_fetch_add(&shard->actorForeign, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&msg->done, 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// hands a paired player's line (or its departure, left) to its game and returns once it has run
+// the poster drains the mailbox itself when the game is idle, otherwise the thread already draining
+// it runs the line too while the poster waits; either way the two players' lines never run at once
+// the event-loop engines keep both players on one thread, so there the poster always runs its own
+int actor_post(struct Game *game, struct connection_data *con, int left){
+    struct gamemsg msg = { NULL, con, left, 0, 0 };
+    int waited = 0;
+
+    msg.next = __atomic_load_n(&game->mailbox, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&game->mailbox, &msg.next, &msg, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // whoever drains last may have missed the line, so keep trying until it has run
+    while (!__atomic_load_n(&msg.done, __ATOMIC_ACQUIRE)) {
+        if (__atomic_exchange_n(&game->running, 1, __ATOMIC_ACQUIRE) == 0) {
+            actor_drain(game, &msg);
+            __atomic_store_n(&game->running, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        waited = 1;
+        sched_yield();
+    }
+    if (waited) __atomic_fetch_add(&shard->actorWaits, 1, __ATOMIC_RELAXED);
+    return msg.result;
+}
+
+// processes the message sitting in con->lineBuffer, through the game's actor once the player is paired
+int handle_message(struct connection_data *con){
+    struct Game *game = __atomic_load_n(&con->game, __ATOMIC_ACQUIRE);
+    if (game == NULL) return handle_line(con, NULL);
+    return actor_post(game, con, 0);
+}
+
+// a message that does not fit the input buffer: the client is still sending it, and closing on unread
+// input would reset the connection before it reads the reply. So the player leaves its game (or the
+// queue) now, its socket is shut for writing once the reply is out, and what it still sends is read
+// and dropped until EOF; a client that keeps sending is cut off after the line timeout
+int too_long(struct connection_data *con){
+    fd_lock(con->fd);
+    waiter_cancel(con);
+    names_release(con);
+    struct Game *game = con->game;
+    fd_unlock(con->fd);
+    if (game != NULL) actor_post(game, con, 1);
+
+    send_fixed(con->fd, REPLY_MESSAGE_TOO_LONG);
+    timer_stop(&con->deadline);
+    timer_set(con, &con->partial, TIMEOUT_LINE);
+    out_lock(con);
+    con->draining = 1;
+    con->shutPending = 1;
+    out_drained(con);
+    out_unlock(con);
+    con->lineLen = con->scanPos = 0;
+    return 1;
+}
+
+// handles every complete line sitting in the input buffer, each is consumed once handled
+int run_lines(struct connection_data *con){
+    while (con->scanPos < con->lineLen) {
+        if (con->draining) { // told it is dropped, see too_long()
+            con->lineLen = con->scanPos = 0;
+            break;
+        }
+        if (con->yourFd->finished == 1) return 0; // the opponent ended the game, drop whatever is left
+        if (con->shutPending) { // shut down once its queue is out, what it still sends is read and dropped
+            con->lineLen = con->scanPos = 0;
+            break;
+        }
+        char *newline = memchr(con->lineBuffer + con->scanPos, '\n', con->lineLen - con->scanPos);
+        if (newline == NULL) {
+            con->scanPos = con->lineLen;
+            break;
+        }
+
+        int frame = newline - con->lineBuffer + 1;
+        con->linePos = frame;
+        int result = handle_message(con);
+        if (result == MSG_CLOSED) return 0;
+        if (result == MSG_NEED_MORE) { // the newline belongs to the message, drop it and keep looking
+            memmove(newline, newline + 1, con->lineLen - frame);
+            con->lineLen--;
+            con->scanPos = frame - 1;
+            continue;
+        }
+
+        con->lineLen -= frame;
+        memmove(con->lineBuffer, con->lineBuffer + frame, con->lineLen);
+        con->scanPos = 0;
+        if (timer_running(&con->partial)) timer_stop(&con->partial);
+        if (result == MSG_MOVED) return 2; // the rest is handled on the new shard
+    }
+
+    if (con->lineLen == LINE_CAP) return too_long(con); // no newline in sight, the buffer cannot grow
+    return 1;
+}
+
+// times the writes of the batch just sent, for every command of it handle_line() timed
+// the opponent's replies were sent (or queued behind its own batch) by the handler already
+void latency_written(struct connection_data *con){
+    if (con->timedLines == 0) return;
+    long long now = now_ns();
+    for (int i = 0; i < con->timedLines; i++) {
+        stat_latency(con->timedCmd[i], LAT_WRITE, now - con->timedAt[i]);
+        stat_latency(con->timedCmd[i], LAT_TOTAL, now - con->readAt);
+    }
+    con->timedLines = 0;
+}
+
+// runs the buffered requests as one batch, their replies are written together
+// returns like feed_bytes()
+int drain_lines(struct connection_data *con){
+    out_cork(con);
+    int result = run_lines(con);
+    out_uncork(con);
+    latency_written(con);
+    if (result == 2) { // the new shard starts its own
+        timer_stop(&con->deadline);
+        timer_stop(&con->partial);
+    } else if (result == 1 && con->lineLen > 0 && !timer_running(&con->partial)) {
+        timer_set(con, &con->partial, TIMEOUT_LINE); // counts from the first byte of the unfinished message
+    }
+    return result;
+}
+
+// feeds bytes received from the socket through the input buffer, handling each complete line
+// partial lines stay buffered until the rest arrives
+// returns 0 once the connection has been closed by one of the messages, 2 once it has to move shards
+int feed_bytes(struct connection_data *con, char *buffer, int bytes){
+    con->readAt = now_ns();
+    while (bytes > 0) {
+        int n = appendLine(con, buffer, bytes);
+        buffer += n;
+        bytes -= n;
+        int result = drain_lines(con);
+        if (result != 1) {
+            if (result == 2 && bytes > 0) appendLine(con, buffer, bytes);
+            return result;
+        }
+    }
+    return 1;
+}
+
+// adds the connection to this shard's file descriptors, returns -1 if there was no memory for it
+int shard_attach(struct connection_data *con){
+    con->yourFd = insertFdList(con->fd);
+    if (con->yourFd == NULL) return -1;
+    con->yourFd->finished = 0;
+    con->yourFd->con = con;
+    return 0;
+}
+
+// registers a freshly accepted connection
+// returns -1 if there was no memory for it, the caller then closes it and frees con
+int session_open(struct connection_data *con){
+    int error, one = 1;
+
+    if (shard_attach(con) == -1) {
+        log_error("event=accept error=\"no memory for a connection\"");
+        return -1;
+    }
+    // replies are small and often come in pairs (WAIT then BEGN, MOVD then OVER); without this the
+    // second one waits for the client's delayed ACK
+    setsockopt(con->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    stat_add(STAT_ACCEPTED, 1);
+
+    // numeric only: a reverse DNS lookup here would stall the event loop and every connection on it
+    error = getnameinfo((struct sockaddr *)&con->addr, con->addr_len,
+    con->host, HOSTSIZE, con->port, PORTSIZE, NI_NUMERICHOST | NI_NUMERICSERV);
+
+    if (error) {
+        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(error));
+        strcpy(con->host, "??");
+        strcpy(con->port, "??");
+    }
+
+    // printf("Connection from %s:%s\n", host, port);
+
+    con->lineLen = 0;
+    con->scanPos = 0;
+    con->linePos = 0;
+
+    //is the client in game? set to 1 after play
+    con->ingame = 0;
+    con->searching = 0;
+    con->closing = 0;
+    con->moving = NULL;
+    con->waiter = NULL;
+    con->entry = NULL;
+    con->game = NULL;
+    con->variant = VARIANT_STANDARD;
+    con->rivalSize = 0;
+
+    con->outBuf = con->sendBuf = NULL;
+    con->outLen = con->outSize = 0;
+    con->sendLen = con->sendSize = con->sendOff = con->sendBusy = 0;
+    con->stalled = con->shutPending = con->draining = con->overflow = 0;
+    con->corked = con->batchReplies = 0;
+    con->writes = con->batchStart = 0;
+    con->armed = con->dead = 0;
+    con->readAt = 0;
+    con->timedLines = 0;
+    con->deadline.link = con->partial.link = NULL;
+    con->timersOff = con->expired = 0;
+    timer_set(con, &con->deadline, TIMEOUT_HANDSHAKE);
+    pthread_mutex_init(&con->outLock, NULL);
+    con->polled = 0;
+    con->ready = 0;
+    return 0;
+}
+
+// tears down a connection once reading has stopped
+// bytes is the result of the last read: 0 for EOF, -1 for an error
+void session_close(struct connection_data *con, int bytes){
+    timers_off(con); // before its descriptor can be reused
+    stat_add(STAT_CLOSED, 1);
+    if (!active) { // server is shutting down, cleanup_fds() closes the socket
+		log_info("peer=%s:%s event=terminating", con->host, con->port);
+        fd_lock(con->fd);
+        waiter_cancel(con);
+        names_release(con);
+        fd_unlock(con->fd);
+        fdList *node = searchFileList(con->fd);
+        if (node) node->con = NULL;
+        game_release(con);
+        if (con->sendBusy) linger(con, 2);
+        session_free(con);
+        return;
+    }
+
+    fdList *inQuestion = searchFileList(con->fd);
+    if (inQuestion && inQuestion->finished == 1) { // game already torn down by either player
+        fd_lock(con->fd);
+        waiter_cancel(con); // an invalid message while waiting ends the connection too
+        names_release(con);
+        Game *currentGame = con->game;
+        fd_unlock(con->fd);
+        // or the player was paired just as its invalid line came in, and the opponent is still playing
+        if (currentGame != NULL) actor_post(currentGame, con, 1);
+        deleteFd(con->fd);
+        close_socket(con);
+        game_release(con);
+    } else { //file quit
+        if (bytes == 0) {
+		    log_info("peer=%s:%s event=eof", con->host, con->port);
+        } else {
+		    log_info("peer=%s:%s event=error error=\"%s\"", con->host, con->port, strerror(errno));
+        }
+        Game *currentGame;
+        // under the lock a player is either still waiting or already in the game it was paired into
+        fd_lock(con->fd);
+        waiter_cancel(con);
+        names_release(con);
+        currentGame = con->game;
+        fd_unlock(con->fd);
+        if (currentGame == NULL){ //file left before game started, or while searching
+            deleteFd(con->fd);
+            close_socket(con);
+        } else { //file quit in-game, the opponent may be moving right now: leave through the game's actor
+            actor_post(currentGame, con, 1);
+            deleteFd(con->fd);
+            close_socket(con);
+            game_release(con);
+        }
+	}
+
+    session_free(con);
+}
+
+// cross-shard handoff: the loop that gave up a connection posts it to the new shard's inbox
+// and wakes that loop through its eventfd
+void shard_post(struct shard *target, struct connection_data *con){
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&target->inboxLock);
+    con->next = target->inbox;
+    target->inbox = con;
+    pthread_mutex_unlock(&target->inboxLock);
+
+    if (write(target->wakefd, &one, sizeof(one)) == -1) perror("eventfd");
+}
+
+// hands a connection this shard's loop no longer watches to con->moving
+void shard_move(struct connection_data *con){
+    deleteFd(con->fd);
+    con->yourFd = NULL;
+    shard_post(con->moving, con);
+}
+
+// empties the inbox, oldest connection first
+struct connection_data *shard_inbox(void){
+    struct connection_data *con, *next, *list = NULL;
+
+    pthread_mutex_lock(&shard->inboxLock);
+    con = shard->inbox;
+    shard->inbox = NULL;
+    pthread_mutex_unlock(&shard->inboxLock);
+
+    for (; con != NULL; con = next) {
+        next = con->next;
+        con->next = list;
+        list = con;
+    }
+    return list;
+}
+
+// takes over a connection handed to this shard and pairs the player
+// whatever arrived behind PLAY is handled afterwards, the result is that of feed_bytes()
+int shard_adopt(struct connection_data *con){
+    if (shard_attach(con) == -1) return 0; // no memory for it here, it is closed
+    con->moving = NULL;
+    shard->handoffsIn++;
+    timer_set(con, &con->deadline, TIMEOUT_LOBBY);
+    int joined = joinGame(con);
+    if (joined == 1) {
+        timer_stop(&con->deadline);
+        return 2;
+    }
+    if (joined == -1) unplay(con);
+    return drain_lines(con);
+}
+
+// event-driven engine: a single thread owns every socket through one epoll instance
+// sockets are non-blocking and edge-triggered, so every ready socket is drained until EAGAIN
+#define MAX_EVENTS 64
+
+int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// no memory for a connection: it is accepted and closed right away, so the client is not left hanging
+// returns -1 if there was nothing to accept
+int accept_refuse(int listener){
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) return -1;
+    log_error("event=accept error=\"no memory for a connection\"");
+    close(fd);
+    return 0;
+}
+
+// accepts every pending connection on the listener
+void loop_accept(int epfd, int listener){
+    struct connection_data *con;
+    struct epoll_event ev;
+
+    while (active) {
+    	con = obj_alloc(POOL_CONN);
+        if (con == NULL) {
+            if (accept_refuse(listener) == -1) return;
+            continue;
+        }
+    	con->addr_len = sizeof(struct sockaddr_storage);
+
+        con->fd = accept(listener, (struct sockaddr *)&con->addr, &con->addr_len);
+        if (con->fd < 0) {
+            int err = errno;
+            obj_free(POOL_CONN, con);
+            if (err == EAGAIN || err == EWOULDBLOCK) return;
+            if (err == EINTR || err == ECONNABORTED) continue;
+            perror("accept");
+            return;
+        }
+
+        if (set_nonblocking(con->fd) == -1) {
+            perror("fcntl");
+            close(con->fd);
+            obj_free(POOL_CONN, con);
+            continue;
+        }
+
+        if (session_open(con) == -1) {
+            close(con->fd);
+            obj_free(POOL_CONN, con);
+            continue;
+        }
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = con;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, con->fd, &ev) == -1) {
+            perror("epoll_ctl");
+            session_close(con, -1);
+        }
+    }
+}
+
+// drains a readable connection; tears it down on EOF, error, or a finished game
+void loop_read(struct connection_data *con){
+    char buffer[BUFSIZE + 1];
+    int bytes;
+
+    for (;;) {
+        if (con->stalled) return; // loop_out() picks it up again
+        bytes = read(con->fd, buffer, BUFSIZE);
+        if (bytes > 0) {
+            stat_add(STAT_BYTES_IN, bytes);
+            int result = feed_bytes(con, buffer, bytes);
+            if (result == 2) { // unread bytes stay in the socket for the new shard
+                epoll_ctl(shard->epfd, EPOLL_CTL_DEL, con->fd, NULL);
+                shard_move(con);
+                return;
+            }
+            if (result == 0 || con->yourFd->finished == 1) {
+                session_close(con, bytes);
+                return;
+            }
+        } else if (bytes == 0) {
+            session_close(con, 0);
+            return;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else {
+            session_close(con, -1);
+            return;
+        }
+    }
+}
+
+// picks up connections other shards handed over
+void loop_wake(void){
+    struct connection_data *con, *next;
+    struct epoll_event ev;
+    uint64_t n;
+
+    if (read(shard->wakefd, &n, sizeof(n)) == -1 && errno != EAGAIN) perror("eventfd");
+
+    for (con = shard_inbox(); con != NULL; con = next) {
+        next = con->next;
+        int result = shard_adopt(con);
+        if (result == 2) {
+            shard_move(con);
+            continue;
+        }
+        if (result == 0 || con->yourFd->finished == 1) {
+            session_close(con, 0);
+            continue;
+        }
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = con;
+        if (epoll_ctl(shard->epfd, EPOLL_CTL_ADD, con->fd, &ev) == -1) {
+            perror("epoll_ctl");
+            session_close(con, -1);
+        }
+    }
+}
+
+// connections still open at shutdown belong to the event loop, release their state
+// (the sockets themselves are closed by cleanup_fds())
+void release_sessions(void){
+    struct connection_data *con, *next;
+
+    for (int i = 0; i < nstripes; i++) {
+        for (fdList *current = shard->stripes[i].fds; current != NULL; current = current->next) {
+            if (current->con) {
+                game_release(current->con);
+                out_free(current->con);
+                obj_free(POOL_CONN, current->con);
+                current->con = NULL;
+            }
+        }
+    }
+    for (con = shard->lingering; con != NULL; con = next) {
+        next = con->next;
+        if (con->dead == 1) close(con->fd);
+        out_free(con);
+        obj_free(POOL_CONN, con);
+    }
+    shard->lingering = NULL;
+}
+
+void run_event_loop(int listener){
+    struct epoll_event ev, events[MAX_EVENTS];
+    int epfd, n;
+
+    if (set_nonblocking(listener) == -1) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    shard->epfd = epfd;
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL marks the listener
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = shard; // the shard marks its wakeup eventfd
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shard->wakefd, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    while (active) {
+        n = epoll_wait(epfd, events, MAX_EVENTS, shard->wheel.running > 0 ? TIMER_TICK_MS : -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                loop_accept(epfd, listener);
+            } else if (events[i].data.ptr == shard) {
+                loop_wake();
+            } else {
+                // flush first, loop_read() may free the connection
+                struct connection_data *con = events[i].data.ptr;
+                int resumed = (events[i].events & EPOLLOUT) && out_flush(con);
+                if (resumed || (events[i].events & ~EPOLLOUT)) loop_read(con);
+            }
+        }
+        wheel_run();
+    }
+
+    release_sessions();
+    close(epfd);
+}
+
+// io_uring engine: like the epoll loop, one thread owns every socket, but accepts, receives and sends
+// all go through the ring, so a batch of moves costs one io_uring_enter instead of a read() and a
+// write() per message
+void uring_arm_accept(struct uring *r, int listener){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_ACCEPT;
+}
+
+int recv_multishot = 1; // cleared if the kernel predates multishot recv (6.0)
+
+void uring_arm_recv(struct uring *r, struct connection_data *con){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = con->fd;
+    sqe->ioprio = recv_multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long)con | URING_RECV;
+    con->armed = 1;
+}
+
+void uring_arm_timer(struct uring *r, struct __kernel_timespec *ts){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)ts;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)ts | URING_OTHER;
+}
+
+// reads the shard's wakeup eventfd, completes when another shard hands over a connection
+void uring_arm_wake(struct uring *r){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = shard->wakefd;
+    sqe->addr = (unsigned long)&shard->wakeval;
+    sqe->len = sizeof(shard->wakeval);
+    sqe->user_data = (unsigned long)&shard->wakeval | URING_OTHER;
+}
+
+// stops the multishot recv of a connection that is moving to another shard
+void uring_cancel_recv(struct uring *r, struct connection_data *con){
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)con | URING_RECV;
+    sqe->user_data = URING_OTHER;
+}
+
+void uring_report(struct uring *r, long *last, int seconds){
+    long sub = r->submissions - last[0], comp = r->completions - last[1], ent = r->enters - last[2];
+    long ticks = r->ticks - last[3];
+    if (sub <= 1 + ticks && comp <= 1 + ticks) return; // only the timers fired
+    log_info("io_uring submissions/s=%ld completions/s=%ld enters/s=%ld sends=%ld",
+        sub / seconds, comp / seconds, ent / seconds, r->sends);
+    last[0] = r->submissions;
+    last[1] = r->completions;
+    last[2] = r->enters;
+    last[3] = r->ticks;
+}
+
+// a connection moves shards once its recv is gone and nothing is being sent to it
+void uring_try_move(struct connection_data *con){
+    if (!con->armed && !con->sendBusy) shard_move(con);
+}
+
+// acts on what feeding a connection returned: keeps its recv going, parks it or starts closing it
+void uring_fed(struct uring *r, struct connection_data *con, int fed){
+    // moving, or stalled until its queue drains: stop receiving
+    // (what a multishot recv already delivered is still handled, there is no room to park it)
+    if (fed == 2 || (fed == 1 && con->stalled)) {
+        if (con->armed == 1) {
+            uring_cancel_recv(r, con);
+            con->armed = 2;
+        } else if (con->armed == 0 && fed == 2) {
+            uring_try_move(con);
         }
-        current = current->next;
+        return;
     }
-    return NULL;
+    int alive = fed == 1 && con->yourFd->finished == 0;
+    if (!alive && con->closing == 0) { // let the final recv completion free the connection
+        con->closing = 1;
+        shutdown_peer(con->fd);
+    }
+    if (!con->armed) uring_arm_recv(r, con);
 }
 
-int findDuplicateName(struct Game *head, char *name){//returns 1 if duplicate name
-    struct Game *current = head->next;
-    // searches for game
-    while (current != NULL){
-        if (strcmp(name, current->playerOneName) == 0){
-            return 1;
-        } else if (current->playerTwo != 0){
-            if (strcmp(name, current->playerTwoName) == 0){
-                return 1;
-            }
+void uring_recv_done(struct uring *r, struct connection_data *con, struct io_uring_cqe *cqe){
+    int res = cqe->res;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) con->armed = 0;
+    if (res > 0) stat_add(STAT_BYTES_IN, res);
+
+    if (con->moving) { // keep what still arrives for the new shard until the recv is gone
+        if (res > 0) {
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            appendLine(con, r->bufs + (size_t)bid * BUFSIZE, res); // past LINE_CAP is dropped
+            uring_recycle(r, bid);
         }
-        current = current->next;
+        if (con->armed) return;
+        if (res == 0) session_close(con, 0);
+        else uring_try_move(con);
+        return;
+    }
+
+    if (res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        int fed = con->closing == 0 ? feed_bytes(con, r->bufs + (size_t)bid * BUFSIZE, res) : 0;
+        uring_recycle(r, bid);
+        uring_fed(r, con, fed);
+    } else if (res == 0) {
+        session_close(con, 0);
+    } else if (res == -ECANCELED) { // stalled, uring_send_done() re-arms it once the queue drains
+        uring_fed(r, con, con->closing == 0 ? drain_lines(con) : 0);
+    } else if (res == -ENOBUFS || res == -EINTR || res == -EAGAIN) { // out of receive buffers, retry
+        if (!con->armed) uring_arm_recv(r, con);
+    } else if (res == -EINVAL && recv_multishot) {
+        puts("io_uring: no multishot recv, using single-shot");
+        recv_multishot = 0;
+        uring_arm_recv(r, con);
+    } else if (!con->armed) {
+        errno = -res;
+        session_close(con, -1);
     }
-    return 0;
 }
 
-struct Game *deleteGame(struct Game *target, struct Game *head){
-    pthread_mutex_lock(&lock);
-    struct Game *current = head;
-    struct Game *prev = current;
-    current = current->next;
-    //If head is the target
-    if (current == NULL){
-        pthread_mutex_unlock(&lock);
-        return head;
+void uring_send_done(struct uring *r, struct connection_data *con, int res){
+    con->sendBusy = 0;
+    if (res > 0) stat_add(STAT_BYTES_OUT, res);
+    if (res > 0 && con->sendOff + res < con->sendLen) { // short send, send the rest
+        con->sendOff += res;
+        uring_send(r, con);
+        return;
     }
-    //Removing middle of the pack
-    while (current != NULL) {
-        if (current == target){
-            if (current->next == NULL){
-                prev->next = NULL;
+    // on an error the rest is dropped, the connection's reader will notice
+
+    if (con->dead) { // closed while this was in flight
+        struct connection_data **link = &shard->lingering;
+        while (*link != con) link = &(*link)->next;
+        *link = con->next;
+        if (con->dead == 1) close(con->fd);
+        con->dead = 0;
+        session_free(con);
+        return;
+    }
+
+    uring_flush(r, con);
+    int resumed = out_drained(con);
+    if (con->moving) {
+        uring_try_move(con);
+    } else if (resumed && con->armed == 0) {
+        uring_fed(r, con, con->closing == 0 ? drain_lines(con) : 0);
+    }
+}
+
+void uring_accept_done(struct uring *r, int listener, struct io_uring_cqe *cqe){
+    if (cqe->res >= 0) {
+    	struct connection_data *con = obj_alloc(POOL_CONN);
+        if (con == NULL) { // no memory for it, the client sees the connection closed
+            log_error("event=accept error=\"no memory for a connection\"");
+            close(cqe->res);
+        } else {
+            con->addr_len = sizeof(struct sockaddr_storage);
+            con->fd = cqe->res;
+            // multishot accept shares one address buffer, so ask for the peer afterwards
+            getpeername(con->fd, (struct sockaddr *)&con->addr, &con->addr_len);
+            if (session_open(con) == 0) {
+                uring_arm_recv(r, con);
             } else {
-                prev->next = current->next;
+                close(con->fd);
+                obj_free(POOL_CONN, con);
             }
-            // Free the dynamically allocated memory
-            if (current->playerOneName) free(current->playerOneName);
-            if (current->playerTwoName) free(current->playerTwoName);
-            if (current->grid) free(current->grid);
-            free(current);
-            pthread_mutex_unlock(&lock);
-            return head;
-        }
-        prev = current;
-        current = current->next;
+        }
+    } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+        log_error("event=accept error=\"%s\"", strerror(-cqe->res));
     }
-    pthread_mutex_unlock(&lock);
-    return head;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) uring_arm_accept(r, listener);
 }
 
-int isNumber(const char* str) {
-    if (str == NULL || *str == '\0') {
-        return 0; // empty string or null pointer
+// picks up connections other shards handed over
+void uring_wake(struct uring *r){
+    struct connection_data *con, *next;
+
+    for (con = shard_inbox(); con != NULL; con = next) {
+        next = con->next;
+        int result = shard_adopt(con);
+        if (result == 2) {
+            shard_move(con);
+        } else if (result == 0 || con->yourFd->finished == 1) {
+            session_close(con, 0);
+        } else {
+            uring_arm_recv(r, con);
+        }
     }
-    while (*str != '\0') {
-        if (!isdigit(*str)) {
-            return 0; // non-digit character found
+    uring_arm_wake(r);
+}
+
+// reaps every available completion, returns how many there were
+int uring_reap(struct uring *r, int listener, struct __kernel_timespec *ts, long *last){
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        unsigned long tag = cqe->user_data & URING_TAG_MASK;
+        void *ptr = (void *)(unsigned long)(cqe->user_data & ~URING_TAG_MASK);
+
+        if (tag == URING_RECV) {
+            uring_recv_done(r, ptr, cqe);
+        } else if (tag == URING_SEND) {
+            uring_send_done(r, ptr, cqe->res);
+        } else if (tag == URING_ACCEPT) {
+            uring_accept_done(r, listener, cqe);
+        } else if (ptr == ts) { // stats timer
+            uring_report(r, last, 1);
+            uring_arm_timer(r, ts);
+        } else if (ptr == &r->tick) {
+            r->ticking = 0;
+            r->ticks++;
+            wheel_run();
+        } else if (ptr == &shard->wakeval) {
+            uring_wake(r);
+        }
+        head++;
+        n++;
+        r->completions++;
+        if (head == tail) {
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
         }
-        str++;
     }
-    return 1;
+    return n;
 }
 
-char* printBoard(int arr[]) {
-    char* str = calloc(10, sizeof(char)); // allocate memory for string
-    int i;
-    for (i = 0; i < 10; i++) {
-        str[i] = arr[i] + '0'; // convert integer to character
+void run_uring_loop(int listener){
+    struct uring r;
+    struct __kernel_timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+    long last[4] = { 0, 0, 0, 0 };
+
+    if (uring_init(&r) == -1) {
+        printf("io_uring unavailable (%s), falling back to epoll\n", strerror(errno));
+        run_event_loop(listener);
+        return;
+    }
+    shard->ring = &r;
+
+    uring_arm_accept(&r, listener);
+    uring_arm_timer(&r, &ts);
+    uring_arm_wake(&r);
+    r.tick.tv_nsec = TIMER_TICK_MS * 1000000L;
+
+    while (active) {
+        if (!r.ticking && shard->wheel.running > 0) {
+            uring_arm_timer(&r, &r.tick);
+            r.ticking = 1;
+        }
+        if (uring_submit(&r, 1) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            break;
+        }
+        uring_reap(&r, listener, &ts, last);
     }
 
-    str[9] = '\0'; // terminate the string
-    return str;
+    // flush what is queued and collect anything that already finished
+    uring_submit(&r, 0);
+    uring_reap(&r, listener, &ts, last);
+    printf("io_uring: %ld submissions, %ld completions, %ld io_uring_enter calls, %ld sends\n",
+        r.submissions, r.completions, r.enters, r.sends);
+
+    shard->ring = NULL;
+    release_sessions();
+    uring_free(&r);
 }
 
-int checkForWin(char square[]){
-    int returnValue = 0;
-    if ((square[0] != '.') && (square[0] == square[1]) && (square[1] == square[2])) returnValue = 1;
-    else if ((square[3] != '.') &&(square[3] == square[4]) && (square[4] == square[5])) returnValue = 1;
-    else if ((square[6] != '.') &&(square[6] == square[7]) && (square[7] == square[8])) returnValue = 1;
-    else if ((square[0] != '.') &&(square[0] == square[4]) && (square[4] == square[8])) returnValue = 1;
-    else if ((square[2] != '.') &&(square[2] == square[4]) && (square[4] == square[6])) returnValue = 1;
-    else if ((square[0] != '.') &&(square[0] == square[3]) && (square[3] == square[6])) returnValue = 1;
-    else if ((square[1] != '.') &&(square[1] == square[4]) && (square[4] == square[7])) returnValue = 1;
-    else if ((square[2] != '.') &&(square[2] == square[5]) && (square[5] == square[8])) returnValue = 1;
-    else returnValue = -1;
-    return returnValue;
+// Added cleanup functions before main()
+void cleanup_games(void) {
+    for (int i = 0; i < nstripes; i++) {
+        struct Game *current = shard->stripes[i].games;
+        while (current != NULL) {
+            struct Game *next = current->next;
+            obj_free(POOL_WIDE, current->wide);
+            obj_free(POOL_GAME, current);
+            current = next;
+        }
+        shard->stripes[i].games = NULL;
+    }
 }
 
-//check if EVERY slot has been used
-int checkForDraw(char square[]){
-    for (int i = 0; i < 9; i++) {
-        if (square[i] == '.') return 0;
+void cleanup_fds(void) {
+    for (int i = 0; i < nstripes; i++) {
+        struct fdList *current = shard->stripes[i].fds;
+        while (current != NULL) {
+            struct fdList *next = current->next;
+            if (current != shard->stripes[i].fds) close(current->fileDescriptor);
+            obj_free(POOL_FD, current);
+            current = next;
+        }
+        shard->stripes[i].fds = NULL;
     }
-  return 1;
 }
 
-#define BUFSIZE 256
-#define HOSTSIZE 100
-#define PORTSIZE 10
-void *read_data(void *arg){
-	struct connection_data *con = arg;
-    char buffer[BUFSIZE + 1], host[HOSTSIZE], port[PORTSIZE];
-    int bytes, error;
-    int pos;
+// threaded engine: a poller hands ready connections to a fixed pool of pre-spawned workers
+// the acceptor thread watches every socket through one epoll instance, each registered one-shot, and
+// deals the connections it reports round-robin onto the workers' deques; a worker whose deque is
+// empty steals from the others. A task flushes and reads what the connection has ready and hands it
+// back to the poller, so -t bounds the threads however many clients there are
+#define POOL_SIZE 64    // default number of workers, -t changes it
+#define DEQUE_SIZE 16   // initial deque capacity, deques grow as needed
+#define TASK_READS 16   // reads per task, a flooding client goes back in line after that
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    struct connection_data **items;
+    int size;  // capacity, a power of two
+    int head;  // oldest item, taken by the owner
+    int count;
+}deque;
+
+struct pool {
+    int size;
+    pthread_t *tids;
+    struct deque *deques;
+    // idle workers sleep on ready until something is queued
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int queued;
+    int peak;
+    struct connection_data *backlog; // tasks no deque had room for, linked through next
+    long *runs;   // tasks run by each worker
+    long *steals; // of those, taken from another worker's deque
+} pool;
+
+int poolSize = POOL_SIZE;
+
+// returns -1 if the deque is full and cannot grow
+int deque_push(struct deque *d, struct connection_data *con){
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->size) {
+        struct connection_data **items = malloc(2 * d->size * sizeof(struct connection_data *));
+        if (items == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (int i = 0; i < d->count; i++) items[i] = d->items[(d->head + i) & (d->size - 1)];
+        free(d->items);
+        d->items = items;
+        d->head = 0;
+        d->size *= 2;
+    }
+    d->items[(d->head + d->count) & (d->size - 1)] = con;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
 
-    if(fileDescriptors == NULL){
-        fileDescriptors = insertFdList(0, fileDescriptors);
+// the owner takes the oldest connection, thieves the newest, so the two rarely meet
+struct connection_data *deque_pop(struct deque *d, int steal){
+    struct connection_data *con = NULL;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        d->count--;
+        if (steal) {
+            con = d->items[(d->head + d->count) & (d->size - 1)];
+        } else {
+            con = d->items[d->head];
+            d->head = (d->head + 1) & (d->size - 1);
+        }
     }
+    pthread_mutex_unlock(&d->lock);
+    return con;
+}
 
-    // traverseGames(gameList);
-    fileDescriptors = insertFdList(con->fd, fileDescriptors);
-    traverseFileDescriptors(fileDescriptors);
+// queues a ready connection on the next worker
+// without memory to grow its deque the task goes on the backlog, which needs none
+void pool_submit(struct connection_data *con){
+    static int next = 0; // only the poller submits
+
+    int full = deque_push(&pool.deques[next], con) == -1;
+    next = (next + 1) % pool.size;
+    pthread_mutex_lock(&pool.lock);
+    if (full) {
+        con->next = pool.backlog;
+        pool.backlog = con;
+    }
+    pool.queued++;
+    if (pool.queued > pool.peak) pool.peak = pool.queued;
+    pthread_cond_signal(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+}
 
-    error = getnameinfo((struct sockaddr *)&con->addr, con->addr_len,
-    host, HOSTSIZE, port, PORTSIZE, NI_NUMERICSERV);
+// next task for worker self: its own deque first, then the others, then the backlog
+// blocks while there is nothing to do, returns NULL once the server shuts down
+struct connection_data *pool_take(int self){
+    struct connection_data *con;
 
-    if (error) {
-        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(error));
-        strcpy(host, "??");
-        strcpy(port, "??");
+    while (active) {
+        con = deque_pop(&pool.deques[self], 0);
+        for (int i = 1; con == NULL && i < pool.size; i++) {
+            con = deque_pop(&pool.deques[(self + i) % pool.size], 1);
+            if (con) pool.steals[self]++;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        if (con == NULL && pool.backlog != NULL) {
+            con = pool.backlog;
+            pool.backlog = con->next;
+        }
+        if (con) {
+            pool.queued--;
+            pthread_mutex_unlock(&pool.lock);
+            return con;
+        }
+        while (pool.queued == 0 && active) pthread_cond_wait(&pool.ready, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
     }
+    return NULL;
+}
 
-    // printf("Connection from %s:%s\n", host, port);
+// one task: flushes what the socket has room for, reads what arrived, then rearms the connection
+// tears it down on EOF, error, or a finished game, like loop_read()
+void pool_run(struct connection_data *con){
+    char buffer[BUFSIZE + 1];
+    int bytes;
+
+    if (con->ready & EPOLLOUT) out_flush(con);
+    for (int i = 0; i < TASK_READS && !con->stalled; i++) {
+        bytes = read(con->fd, buffer, BUFSIZE);
+        if (bytes > 0) {
+            stat_add(STAT_BYTES_IN, bytes);
+            if (feed_bytes(con, buffer, bytes) == 0 || con->yourFd->finished == 1) {
+                session_close(con, bytes);
+                return;
+            }
+        } else if (bytes == 0) {
+            session_close(con, 0);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            session_close(con, -1);
+            return;
+        }
+    }
 
-    char *lineBuffer = malloc(BUFSIZE);
-    int lineSize = BUFSIZE;
-    int linePos = 0;
-	readList *list = NULL;
+    out_lock(con);
+    int armed = poll_arm(con, EPOLL_CTL_MOD);
+    out_unlock(con);
+    if (armed == -1) session_close(con, -1);
+}
 
-    fdList *yourFd = searchFileList(con->fd);
-    yourFd->finished = 0;
-    //is the client in game? set to 1 after play
-    int ingame = 0;
-    int searching = 0;
-
-    while ((yourFd->finished == 0) && active && (bytes = read(con->fd, buffer, BUFSIZE)) > 0) { //con->fd is this thread's current file descriptor
-        puts("\n");
-
-		for (pos = 0; pos < bytes; ++pos) {
-			if (buffer[pos] == '\n') {
-				int thisLen = pos + 1;
-//////////////  vvvvv where append originally was vvvvv
-
-                    // buf is buffer + lstart
-                    // thisLen is len
-
-                char *buf = buffer;
-                int len = thisLen;
-                
-                int newPos = linePos + len;
-                if (newPos > lineSize) {
-                    lineSize *= 2;
-                    assert(lineSize >= newPos);
-                    lineBuffer = realloc(lineBuffer, lineSize);
-                    if (lineBuffer == NULL) {
-                        perror("line buffer");
-                        exit(EXIT_FAILURE);
-                    }
-                }
+void *pool_worker(void *arg){
+    int self = (int)(long)arg;
+    struct connection_data *con;
 
-                memcpy(lineBuffer + linePos, buf, len);
-                linePos = newPos;
+    shard = &shards[0];
+    while ((con = pool_take(self)) != NULL) {
+        pool.runs[self]++;
+        pool_run(con);
+    }
+    pools_flush();
+    log_release();
+    return NULL;
+}
 
-//////////////  ^^^^^ where append originally was ^^^^^
+// the poller reported fd: queue its connection unless a worker has it already
+// (an event can predate the worker's rearm, or the descriptor's reuse; either way it is dropped)
+void pool_ready(int fd, unsigned events){
+    fd_lock(fd);
+    fdList *node = searchFileList(fd);
+    struct connection_data *con = node ? node->con : NULL;
+    if (con) {
+        out_lock(con);
+        int idle = con->polled;
+        con->polled = 0;
+        con->ready = events;
+        out_unlock(con);
+        if (idle) pool_submit(con);
+    }
+    fd_unlock(fd);
+}
 
-				list = turnToRL(linePos, lineBuffer, list);
-                traverseRL(list);
+// accepts every pending connection and hands it to the poller
+void pool_accept(int listener){
+    struct connection_data *con;
 
-                int runThrough = 0;
-                int howManyPipes = 0;
-                while ((runThrough < linePos - 1)){ //reads the first four characters
-                    if (lineBuffer[runThrough] == '|'){
-                        howManyPipes++;
-                        //allocates size of thing before space
-                    }
-                    runThrough++;
-                }
-                if (howManyPipes < 2){
-                    list = freeRL(list);
-                    char *reason = "INVL|31|Cannot measure size accurately|"; ///////////////////////////////////////////////////////////////////////////
-                    write(con->fd, reason, strlen(reason));
-                    if (yourFd->ingame == 1){
-                        Game *thisGame = findGame(gameList, con->fd);
-                        char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                        fdList *otherFd;
-                        if (con->fd == thisGame->playerOne) {
-                            write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerTwo);
-                        } else { //con->fd is player Two
-                            write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(thisGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                    } else { //not in a game
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                    }
-				    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break;
-                }
+    while (active) {
+    	con = obj_alloc(POOL_CONN);
+        if (con == NULL) {
+            if (accept_refuse(listener) == -1) return;
+            continue;
+        }
+    	con->addr_len = sizeof(struct sockaddr_storage);
 
+        con->fd = accept(listener, (struct sockaddr *)&con->addr, &con->addr_len);
+        if (con->fd < 0) {
+            int err = errno;
+            obj_free(POOL_CONN, con);
+            if (err == EAGAIN || err == EWOULDBLOCK) return;
+            if (err == EINTR || err == ECONNABORTED) continue;
+            perror("accept");
+            return;
+        }
 
+        if (set_nonblocking(con->fd) == -1) {
+            perror("fcntl");
+            close(con->fd);
+            obj_free(POOL_CONN, con);
+            continue;
+        }
 
-                if (list == NULL){
-                    list = freeRL(list);
-                    char *reason = "INVL|16|Invalid command|"; ///////////////////////////////////////////////////////////////////////////
-                    write(con->fd, reason, strlen(reason));
-                    if (yourFd->ingame == 1){
-                        Game *thisGame = findGame(gameList, con->fd);
-                        char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                        fdList *otherFd;
-                        if (con->fd == thisGame->playerOne) {
-                            write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerTwo);
-                        } else { //con->fd is player Two
-                            write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerOne);
-                        }
-                         pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(thisGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                    } else { //not in a game
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                    }
-				    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break;
-                } else if (list->next == NULL){
-                // use THIS code right here for when the code's wrong for now...
-                    list = freeRL(list);
-                    char *reason = "INVL|16|Invalid command|"; ///////////////////////////////////////////////////////////////////////////
-                    write(con->fd, reason, strlen(reason));
-                    if (yourFd->ingame == 1){
-                        Game *thisGame = findGame(gameList, con->fd);
-                        char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                        fdList *otherFd;
-                        if (con->fd == thisGame->playerOne) {
-                            write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerTwo);
-                        } else { //con->fd is player Two
-                            write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(thisGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                    } else { //not in a game
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                    }
-				    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break;
-                }////
-                
-                
-                // checks if it was a complete message
-                readList *fieldTwo = list->next;
-                int fieldChecker = isNumber(fieldTwo->data);
-                int fieldNumber = 0;
-                int firstTwoFields;
-                int addl_bytes = 0;
-                if (fieldChecker == 1){ // it's a number
-                    fieldNumber = atoi(fieldTwo->data);
-                    firstTwoFields = fieldTwo->size + 6;
-                    fieldNumber = fieldNumber + firstTwoFields; //what the byte length should be
-                    if (fieldNumber > (bytes - 1)){ // need to read one more time
-                        list = freeRL(list);
-                        addl_bytes = read(con->fd, buffer + (bytes - 1), BUFSIZE - bytes); //edge case needed if read returns 0 or -1
-                        pos = bytes - 1;
-                        thisLen = pos + 1;
-
-                        buf = buffer;
-                        len = thisLen;                        
-                        linePos = 0;
-                        newPos = linePos + len;
-                        if (newPos > lineSize) {
-                            lineSize *= 2;
-                            assert(lineSize >= newPos);
-                            lineBuffer = realloc(lineBuffer, lineSize);
-                            if (lineBuffer == NULL) {
-                                perror("line buffer");
-                                exit(EXIT_FAILURE);
-                            }
-                        }
-                        memcpy(lineBuffer + linePos, buf, len + addl_bytes - 1);
-                        linePos = newPos + addl_bytes - 1;
-
-                        list = turnToRLCompletely(linePos, lineBuffer, list); //add the rest, then merge the third field with next if necessary.
-                    } else if (fieldNumber < (bytes - 1)){ // size is smaller - kill the program
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Incorrect bytes|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                    }
-                } else { // err - not a number
-                            list = freeRL(list);
-                            char *reason = "INVL|23|Field two not a number|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                }
+        if (session_open(con) == -1) {
+            close(con->fd);
+            obj_free(POOL_CONN, con);
+            continue;
+        }
 
-                readList *findLength = list;
-                findLength = findLength->next->next; //name->length->next args
+        out_lock(con);
+        int armed = poll_arm(con, EPOLL_CTL_ADD);
+        out_unlock(con);
+        if (armed == -1) session_close(con, -1);
+    }
+}
 
+void pool_start(int size){
+    pool.size = size;
+    pool.tids = calloc(size, sizeof(pthread_t));
+    pool.deques = calloc(size, sizeof(struct deque));
+    pool.runs = calloc(size, sizeof(long));
+    pool.steals = calloc(size, sizeof(long));
+    if (pool.tids == NULL || pool.deques == NULL || pool.runs == NULL || pool.steals == NULL) {
+        perror("pool");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+
+    for (int i = 0; i < size; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].size = DEQUE_SIZE;
+        pool.deques[i].items = malloc(DEQUE_SIZE * sizeof(struct connection_data *));
+        if (pool.deques[i].items == NULL) {
+            perror("pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < size; i++) {
+        int error = pthread_create(&pool.tids[i], NULL, pool_worker, (void *)(long)i);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-                int listLength = 0;                
-                while (findLength != NULL){
-                    listLength = listLength + findLength->size + 1;
-                    findLength = findLength->next;
-                } 
+// wakes every worker, waits for them to finish their task and prints the stats
+// queued tasks are dropped, their connections are released with the rest
+void pool_stop(void){
+    long runs = 0, steals = 0;
 
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_broadcast(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
 
-                printf("updated -> ");
-                traverseRL(list);
+    for (int i = 0; i < pool.size; i++) {
+        pthread_join(pool.tids[i], NULL);
+        runs += pool.runs[i];
+        steals += pool.steals[i];
+    }
+    printf("pool: %d workers, %ld tasks run, %ld stolen, at most %d queued\n",
+        pool.size, runs, steals, pool.peak);
 
-                assert(lineBuffer[linePos-1] == '\n');
+    for (int i = 0; i < pool.size; i++) {
+        free(pool.deques[i].items);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(pool.tids);
+    free(pool.runs);
+    free(pool.steals);
+    pthread_cond_destroy(&pool.ready);
+    pthread_mutex_destroy(&pool.lock);
+}
 
-                readList *current = list; //name
+// threaded engine: this thread is the poller, accepting connections and dealing ready ones to the pool
+void run_threads(int listener, sigset_t *mask){
+    struct epoll_event ev, events[MAX_EVENTS];
+    int error, n;
 
-/////////////////// CHECK THE SECOND FIELD. ///////////////////
-                int fieldTwoNumber = atoi(fieldTwo->data);
-                if ((fieldTwoNumber < listLength) || (fieldTwoNumber > listLength)){ // err - the length is wrong.
-                    list = freeRL(list);
-                    char *reason = "INVL|16|Incorrect bytes|";
-                    write(con->fd, reason, strlen(reason));
-                    if (yourFd->ingame == 1){
-                        Game *thisGame = findGame(gameList, con->fd);
-                        char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                        fdList *otherFd;
-                        if (con->fd == thisGame->playerOne) {
-                            write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerTwo);
-                        } else { //con->fd is player Two
-                            write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(thisGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                    } else { //not in a game
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                    }
-                    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break;
-                }
+    if (set_nonblocking(listener) == -1) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+    shard->epfd = epoll_create1(0);
+    if (shard->epfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    if (epoll_ctl(shard->epfd, EPOLL_CTL_ADD, listener, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
 
+    // temporarily disable signals
+    // (the workers inherit this mask, ensuring that SIGINT is
+    // only delivered to this thread)
+    error = pthread_sigmask(SIG_BLOCK, mask, NULL);
+    if (error != 0) {
+    	fprintf(stderr, "sigmask: %s\n", strerror(error));
+    	exit(EXIT_FAILURE);
+    }
 
-                // returns the current game that the client is in
-                Game *currentGame = NULL;
-                if (ingame == 1){
-                    currentGame = findGame(gameList, con->fd);
-                }
+    pool_start(poolSize);
+    for (int i = 0; i < TIMEOUTS; i++) tickerStarted |= timeouts[i] > 0;
+    if (tickerStarted && (error = pthread_create(&tickerThread, NULL, run_ticker, NULL)) != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
 
-// PLAY -> 10 -> Joe Smith -> NULL
+    // unblock handled signals
+    error = pthread_sigmask(SIG_UNBLOCK, mask, NULL);
+    if (error != 0) {
+    	fprintf(stderr, "sigmask: %s\n", strerror(error));
+    	exit(EXIT_FAILURE);
+    }
 
-                // play has 4 arguments
-                if (strcmp("PLAY", current->data) == 0){ //don't need to check if draw == 0 since it already won't work if you're in a game (plus a game doesn't exist at this point and it breaks if I check it)
-                    if (ingame == 1){ // err - game has already started
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Already in game|"; ///////////////////////////////////////////////////////////////////////////
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    } else if (current->next == NULL || current->next->next == NULL || current->next->next->next != NULL){ // err - length is empty
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Invalid command|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                    } else { //everything looks good...
-
-                        // it's the second field now.
-                        current = current->next;
-
-                        // third field.
-                        current = current->next;
-                        if (current->size > 50){ // err - name too long
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Name's too long|"; ///////////////////////////////////////////////////////////////////////////
-                                                  //Name's too long|
-                            write(con->fd, reason, strlen(reason));
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            continue;
-                        }
-
-                        if (gameList != NULL){
-                            int check = findDuplicateName(gameList, current->data);
-                            if (check == 1){
-                                list = freeRL(list);
-                                char *reason = "INVL|16|Name is occupied|"; ///////////////////////////////////////////////////////////////////////////
-                                                   //17|Name is occupied|
-                                write(con->fd, reason, strlen(reason));
-                                linePos = 0;
-                                buffer[bytes] = '\0';
-                                continue;
-                            }
-                        }
-
-                        ingame = 1;
-                        searching = 1;
-
-                        //everything looks all set? then execute play.
-                        char *reason = "WAIT|0|";
-                        write(con->fd, reason, strlen(reason));
-                        sleep(1);
-                        if (gameList == NULL){
-                            gameList = initGame(gameList);
-                            puts("init game\n");
-                        }
-
-                        gameList = insertGame(current->data, gameList, con->fd, current->size);
-                        traverseGames(gameList);
-                    }
+    while (active) {
+        n = epoll_wait(shard->epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue; // SIGINT clears active
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == listener) {
+                pool_accept(listener);
+            } else {
+                pool_ready(events[i].data.fd, events[i].events);
+            }
+        }
+    }
 
+    pool_stop();
+    if (tickerStarted) pthread_join(tickerThread, NULL);
+    release_sessions();
+    close(shard->epfd);
+    shard->epfd = -1;
+}
 
+// sets up shard i, the wakeup eventfd is only used once there are several
+int shard_init(struct shard *s, int i){
+    pthread_mutexattr_t attr;
+    unsigned waitqSize = WAITQ_SIZE;
+    struct rlimit limit;
+
+    memset(s, 0, sizeof(struct shard));
+    s->index = i;
+    s->gameCount = i + 1;
+    s->listener = -1;
+    s->epfd = -1;
+
+    // recursive: paths holding a player's stripe may call helpers that lock it again
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    s->stripes = calloc(nstripes, sizeof(struct stripe));
+    if (s->stripes == NULL) {
+        perror("stripes");
+        return -1;
+    }
+    for (int j = 0; j < nstripes; j++) {
+        if (pthread_mutex_init(&s->stripes[j].lock, &attr) != 0 || pthread_mutex_init(&s->stripes[j].gamesLock, NULL) != 0) {
+            printf("\nMutex init has failed\n");
+            return -1;
+        }
+        s->stripes[j].fds = obj_calloc(POOL_FD);
+        s->stripes[j].games = initGame();
+        if (s->stripes[j].fds == NULL || s->stripes[j].games == NULL) {
+            fprintf(stderr, "stripes: out of memory\n");
+            return -1;
+        }
+    }
+    pthread_mutexattr_destroy(&attr);
+    if (pthread_mutex_init(&s->inboxLock, NULL) != 0 || pthread_mutex_init(&s->wheel.lock, NULL) != 0) {
+        printf("\nMutex init has failed\n");
+        return -1;
+    }
+    s->wheel.start = now_ns();
 
-//MOVE -> 6 -> X -> 2,2 -> NULL
-                } else if (strcmp("MOVE", current->data) == 0) {
-                    if (ingame == 0){ // err - game hasn't started
-                        list = freeRL(list);
-                        char *reason = "INVL|20|Game hasn't started|"; ///////////////////////////////////////////////////////////////////////////
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    } else if (current->next == NULL || current->next->next == NULL || current->next->next->next == NULL
-                                || current->next->next->next->next != NULL){ // err - length is empty
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Invalid command|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                    } else if (currentGame->draw != 0) { // err - draw was called, what are you doing brother
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Draw was called|"; ///////////////////////////////////////////////////////////////////////////
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    }
-                    searching = 0;
-                    
-                    // it's the second field now.
-                    current = current->next;
-                    //should check if the length is 6
-
-                    // third field. the character.
-                    current = current->next;
-
-                    // is it just one character (the mark)?
-                    // check to see if the string given is either X or O
-                    char mark[2];
-                    mark[1] = '\0';
-                    int remember; //0 if X, 1 if O
-                    if (strcmp("X", current->data) == 0){ 
-                        mark[0] = 'X'; // it's X
-                        remember = 0;
-                    } else if (strcmp("O", current->data) == 0){ 
-                        mark[0] = 'O'; // it's O
-                        remember = 1;
-                    } else { // err - neither X nor O
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Invalid command|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                    }
-                    
-                    //ensures the right player is moving, the makes sure they're using the right mark
-                    if ((currentGame->turn == 0) && (con->fd == currentGame->playerOne)) {
-                        if (remember == 1) { // err - wrong mark. O when should be X
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Wrong role used|"; ///////////////////////////////////////////////////////////////////////////
-                            write(con->fd, reason, strlen(reason));
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            continue;
-                        }
-                    } else if ((currentGame->turn == 1) && (con->fd == currentGame->playerTwo)) {
-                        if (remember == 0) { // err - wrong mark. X when should be O
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Wrong role used|"; ///////////////////////////////////////////////////////////////////////////
-
-                            write(con->fd, reason, strlen(reason));
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            continue;
-                        }
-                    } else { //wrong player
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Wait your turn!|"; ///////////////////////////////////////////////////////////////////////////
-                                              //Wait your turn!
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    }
-                    
-                    //fourth field
-                    current = current->next;
-                    //we need the exact coords of where the move is being made
-                    int fourthSize = current->size;
-                    if (fourthSize != 3){ // err - size needs to be 3
-                            list = freeRL(list);
-                            char *reason = "INVL|16|Invalid command|";
-                            write(con->fd, reason, strlen(reason));
-                            if (yourFd->ingame == 1){
-                                Game *thisGame = findGame(gameList, con->fd);
-                                char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                                fdList *otherFd;
-                                if (con->fd == thisGame->playerOne) {
-                                    write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerTwo);
-                                } else { //con->fd is player Two
-                                    write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                    otherFd = searchFileList(thisGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //not in a game
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                            }
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            break;
-                    }
-
-                    char *fourthData = current->data;
-                    if ((isdigit(fourthData[0]) == 0) || (isdigit(fourthData[2])) || (fourthData[1] != ',')){ // err - digit needs to be a number
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Invalid command|";
-                        write(con->fd, reason, strlen(reason));
-                        if (yourFd->ingame == 1){
-                            Game *thisGame = findGame(gameList, con->fd);
-                            char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                            fdList *otherFd;
-                            if (con->fd == thisGame->playerOne) {
-                                write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerTwo);
-                            } else { //con->fd is player Two
-                                write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerOne);
-                            }
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                            close(otherFd->fileDescriptor);
-                        } else { //not in a game
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                        }
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;
-                    }
-                    char coords[5];
-                    coords[0] = fourthData[0];
-                    coords[1] = ',';
-                    coords[2] = fourthData[2];
-                    coords[3] = '|';
-                    coords[4] = '\0';
-
-                    //since the grid is a single array, add the coords minus 1 to get exactly where it should be in the array
-                    int sum = 0;  
-                    // 0 1 2
-                    // 3 4 5
-                    // 6 7 8
-                    char first = coords[0];
-                    char second = coords[2];
-                    int firstInt = first - '0';
-                    int secondInt = second - '0';
-
-                    if (firstInt == 2) sum = 3;
-                    else if (firstInt == 3) sum = 6;
-                    sum += (secondInt);
-                    sum = sum - 1;
-
-                    //the very last check! ensure there isn't a mark where the move is being made
-
-                    // printf("%d\n", sum);
-
-                    // printf("%s\n", board);
-
-                    if (currentGame->grid[sum] != '.') { // err - space is occupied 
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Space occupied.|"; ///////////////////////////////////////////////////////////////////////////
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    }
-                    //everything looks all set? then execute move.
-                    currentGame->grid[sum] = mark[0];
-                    // printf("%s\n", board);
-
-                    //now the server has to reply to both with the move made
-                    // char* board = printBoard(gameList->grid);
-
-
-                    char *movd = "MOVD|16|";
-                    // printf("\n%s", movd);
-                    // printf("%s", mark);
-                    char *bar = "|";
-                    // printf("%s", bar);
-                    // printf("%s", coords);
-                    // printf("%s", board);
-                    // printf("%s\n\n", bar);
-
-                    char *reason = calloc(150, sizeof(char));
-                    strcpy(reason, movd);
-                    strcat(reason, mark);
-                    strcat(reason, bar);
-                    strcat(reason, coords);
-                    strcat(reason, currentGame->grid);
-                    strcat(reason, bar);
-                    // printf("\n%s\n\n", reason);
-
-                    printf("%s\n", currentGame->grid);
-
-                    //writes the updated position
-                    write(con->fd, reason, strlen(reason));
-                    if (con->fd == currentGame->playerOne) {
-                        write(currentGame->playerTwo, reason, strlen(reason));
-                    } else {
-                        write(currentGame->playerOne, reason, strlen(reason));
-                    }
-                    free(reason);
-                    
-                    //who won?
-                    int over = checkForWin(currentGame->grid); //it should check if the game is won due to the move made
-                    //con->fd is the winner
-                    int opponentSize;
-                    char winnerName[85];
-                    
-                    if (currentGame->playerTwo == con->fd){
-                        opponentSize = currentGame->playerTwoSize;
-                        strcpy(winnerName, currentGame->playerTwoName);
-                    } else if (currentGame->playerOne == con->fd){
-                        opponentSize = currentGame->playerOneSize;
-                        strcpy(winnerName, currentGame->playerOneName);
-                    }
-
-                    opponentSize = opponentSize + 12;
-                    char *gameOver = "OVER|";
-
-                    char lengthOfRest[99];
-                    sprintf(lengthOfRest, "%d", opponentSize);
-
-                    char *win = "W|";
-                    char *loss = "L|";
-                    char *hasWon = " has won.";
-
-                    char winReason[150];
-                    char lossReason[150];
-
-                    // printf("\n\n%s", gameOver);       
-                    // printf("%s", lengthOfRest);
-                    // printf("%s", bar);
-                    // printf("%s", win);
-                    // printf("%s", winnerName);
-                    // printf("%s\n", hasWon);
-
-                    strcpy(winReason, gameOver);
-                    strcat(winReason, lengthOfRest);
-                    strcat(winReason, bar);
-                    strcat(winReason, win);
-                    strcat(winReason, winnerName);
-                    strcat(winReason, hasWon);
-                    strcat(winReason, bar);
-
-                    strcpy(lossReason, gameOver);
-                    strcat(lossReason, lengthOfRest);
-                    strcat(lossReason, bar);
-                    strcat(lossReason, loss);
-                    strcat(lossReason, winnerName);
-                    strcat(lossReason, hasWon);
-                    strcat(lossReason, bar);
-
-
-                    if (over == 1) { //if the game is over
-                        fdList *otherFd;
-                        if (con->fd == currentGame->playerOne) {
-                            printf("%s\n", winReason);
-                            write(con->fd, winReason, strlen(winReason));
-                            write(currentGame->playerTwo, lossReason, strlen(lossReason));
-                            otherFd = searchFileList(currentGame->playerTwo);
-
-                        } else { //con->fd is player Two
-                            write(con->fd, winReason, strlen(winReason));
-                            write(currentGame->playerOne, lossReason, strlen(lossReason));
-                            otherFd = searchFileList(currentGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(currentGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                        ingame = 0;
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;                    }
-                    //now we need to know if the game should end by default due to no more possible moves existing
-                    if (checkForDraw(currentGame->grid) == 1) {
-                        fdList *otherFd;
-
-                        char *reason = "OVER|17|D|No moves left.|";
-                        write(con->fd, reason, strlen(reason));
-                        if (con->fd == currentGame->playerOne) {
-                            write(currentGame->playerTwo, reason, strlen(reason));
-                            otherFd = searchFileList(currentGame->playerTwo);
-                        } else {
-                            write(currentGame->playerOne, reason, strlen(reason));
-                            otherFd = searchFileList(currentGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                                deleteGame(currentGame, gameList);
-
-                        pthread_mutex_unlock(&lock);
-                        close(currentGame->playerOne);
-                        close(currentGame->playerTwo);
-                        ingame = 0;
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break; 
-                    }
-
-                    //should probably alternate the turns once all of this is done too, teehee
-                    pthread_mutex_lock(&lock);
-                    if (currentGame->turn == 0) {
-                        currentGame->turn = 1;
-                    } else {
-                        currentGame->turn = 0;
-                    }
-                    pthread_mutex_unlock(&lock);
+    s->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->wakefd == -1) {
+        perror("eventfd");
+        return -1;
+    }
 
+    // no descriptor can reach RLIMIT_NOFILE, so the table covers every connection unless that is huge
+    s->fdSlots = FD_TABLE_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < FD_TABLE_MAX) s->fdSlots = limit.rlim_cur;
+    s->byFd = calloc(s->fdSlots, sizeof(struct fdList *));
+    if (s->byFd == NULL) {
+        perror("descriptor table");
+        return -1;
+    }
 
-// RSGN Indicates that the player has resigned.
-    // The server will respond with OVER.
+    // every pool worker may be queueing a player at once
+    if (engine == ENGINE_THREADS) {
+        while (waitqSize < 2 * (unsigned)poolSize) waitqSize *= 2;
+    }
+    for (int v = 0; v < VARIANTS; v++) {
+        if (waitq_init(&s->waitq[v], waitqSize) == -1) {
+            perror("waiting queue");
+            return -1;
+        }
+    }
+    return 0;
+}
 
-//RSGN -> NULL
-                } else if (strcmp("RSGN", current->data) == 0){
-                    if ((ingame == 0) || (current->next == NULL) || (current->next->next != NULL)){ // err - game hasn't started || err - resign has too many args                        list = freeRL(list);
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Invalid command|";
-                        write(con->fd, reason, strlen(reason));
-                        if (yourFd->ingame == 1){
-                            Game *thisGame = findGame(gameList, con->fd);
-                            char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                            fdList *otherFd;
-                            if (con->fd == thisGame->playerOne) {
-                                write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerTwo);
-                            } else { //con->fd is player Two
-                                write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerOne);
-                            }
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                            close(otherFd->fileDescriptor);
-                        } else { //not in a game
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                        }
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;
-                    } else if (currentGame->draw != 0) { // err - draw was called, what are you doing brother
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Draw was called|"; ///////////////////////////////////////////////////////////////////////////
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    }
-                    searching = 0;
-
-                    //send the resign function to both file descriptors
-                    //we need to know WHO lost exactly
-
-                    int opponentSize;
-                    char loserName[85];
-                    
-                    if (currentGame->playerTwo == con->fd){
-                        opponentSize = currentGame->playerTwoSize;
-                        strcpy(loserName, currentGame->playerTwoName);
-                    } else if (currentGame->playerOne == con->fd){
-                        opponentSize = currentGame->playerOneSize;
-                        strcpy(loserName, currentGame->playerOneName);
-                    }
-
-                    opponentSize = opponentSize + 13;
-                    char *gameOver = "OVER|";
-
-                    char lengthOfRest[99];
-                    sprintf(lengthOfRest, "%d", opponentSize);
-                    
-                    char *win = "W|";
-                    char *loss = "L|";
-                    char *bar = "|";
-                    char *hasResigned = " resigned.";
-
-                    char winReason[150];
-                    char lossReason[150];
-
-                    strcpy(winReason, gameOver);
-                    strcat(winReason, lengthOfRest);
-                    strcat(winReason, bar);
-                    strcat(winReason, loss);
-                    strcat(winReason, loserName);
-                    strcat(winReason, hasResigned);
-                    strcat(winReason, bar);
-
-                    strcpy(lossReason, gameOver);
-                    strcat(lossReason, lengthOfRest);
-                    strcat(lossReason, bar);
-                    strcat(lossReason, win);
-                    strcat(lossReason, loserName);
-                    strcat(lossReason, hasResigned);
-                    strcat(lossReason, bar);
-
-                    write(con->fd, lossReason, strlen(lossReason));
-                    fdList *otherFd;
-                    //the message sent to the winner (by default) is slightly different with the W instead of the L
-                    if (con->fd == currentGame->playerOne) {
-                        write(currentGame->playerTwo, winReason, strlen(winReason));
-                        otherFd = searchFileList(currentGame->playerTwo);
-                    } else {
-                        write(currentGame->playerOne, winReason, strlen(winReason));
-                        otherFd = searchFileList(currentGame->playerOne);
-                    }
-
-                    pthread_mutex_lock(&lock);
-                    yourFd->finished = 1;
-                    otherFd->finished = 1;
-                                deleteGame(currentGame, gameList);
-
-                    pthread_mutex_unlock(&lock);
-                    close(currentGame->playerOne);
-                    close(currentGame->playerTwo);
-                    ingame = 0;
-                    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break; 
+// releases connections still waiting in the inbox and players still waiting for an opponent at shutdown
+void shard_free(void){
+    struct connection_data *con, *next;
+    struct waiter *w;
 
+    for (con = shard_inbox(); con != NULL; con = next) {
+        next = con->next;
+        close(con->fd);
+        out_free(con);
+        obj_free(POOL_CONN, con);
+    }
+    for (int v = 0; v < VARIANTS; v++) {
+        while ((w = waitq_pop(&shard->waitq[v])) != NULL) free(w);
+        free(shard->waitq[v].cells);
+    }
+    free(shard->byFd);
+    close(shard->wakefd);
+    pthread_mutex_destroy(&shard->inboxLock);
+    pthread_mutex_destroy(&shard->wheel.lock);
+    for (int i = 0; i < nstripes; i++) {
+        pthread_mutex_destroy(&shard->stripes[i].lock);
+        pthread_mutex_destroy(&shard->stripes[i].gamesLock);
+    }
+    free(shard->stripes);
+}
 
+// -w: one event loop per worker thread, each pinned to a core with its own shard and listener
+void *run_worker(void *arg){
+    cpu_set_t cpus;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-// DRAW Depending on the message, this indicates that the player is suggesting a draw (S), or is
-    // accepting (A) or rejecting (R) a draw proposed by their opponent.
-    // Note that DRAW A or DRAW R can only be sent in response to receiving a DRAW S from the server.
+    shard = arg;
+    if (ncpu > 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->index % ncpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
 
-// DRAW -> 2 -> S -> NULL
-                } else if (strcmp("DRAW", current->data) == 0) {
-                    if ((ingame == 0) || (current->next == NULL) || (current->next->next == NULL)|| (current->next->next->next != NULL)){ // err - game hasn't started
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Invalid command|";
-                        write(con->fd, reason, strlen(reason));
-                        if (yourFd->ingame == 1){
-                            Game *thisGame = findGame(gameList, con->fd);
-                            char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                            fdList *otherFd;
-                            if (con->fd == thisGame->playerOne) {
-                                write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerTwo);
-                            } else { //con->fd is player Two
-                                write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerOne);
-                            }
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                            close(otherFd->fileDescriptor);
-                        } else { //not in a game
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                        }
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;
-                    }
-                    searching = 0;
-                    if ((currentGame->turn == 1) && (con->fd == currentGame->playerOne)) {
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Wait your turn!|"; ///////////////////////////////////////////////////////////////////////////
-                                              //Wait your turn!
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    } else if ((currentGame->turn == 0) && (con->fd == currentGame->playerTwo)) {
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Wait your turn!|"; ///////////////////////////////////////////////////////////////////////////
-                                              //Wait your turn!
-
-                        write(con->fd, reason, strlen(reason));
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        continue;
-                    }
-
-                    //second field
-                    current = current->next;
-                    //should probably check the length, idk
-
-                    //third field
-                    current = current->next;
-
-                    //is draw even being used right?
-                    if (strcmp("S", current->data) == 0){
-                        if (currentGame->draw == 0) { //draw had not been called yet
-                            currentGame->draw = 1;
-                            char *reason = "DRAW|2|S|";
-                            //sends request to other player
-                            if (con->fd == currentGame->playerOne) {
-                                write(currentGame->playerTwo, reason, strlen(reason));
-                            }
-                            else {
-                                write(currentGame->playerOne, reason, strlen(reason));
-                            }
-                            currentGame->olive = con->fd;
-                            pthread_mutex_lock(&lock);
-                            currentGame->olive = con->fd;
-                            if (currentGame->turn == 0) {
-                                currentGame->turn = 1;
-                            } else {
-                                currentGame->turn = 0;
-                            }
-                            pthread_mutex_unlock(&lock);
-                        } else { // error - can't send draw when you have to send either A or R.
-                            list = freeRL(list);
-                            char *reason = "INVL|20|Draw already called|"; ///////////////////////////////////////////////////////////////////////////
-                            write(con->fd, reason, strlen(reason));
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            continue;  
-                        }
-                         //draw had been called
-                    } else if (strcmp("A", current->data) == 0 || strcmp("R", current->data) == 0) {
-                        //execute draw
-                        if (currentGame->draw == 0) { //error - draw had not been called yet
-                            char *reason = "INVL|16|Draw not called|"; ///////////////////////////////////////////////////////////////////////////
-                            write(con->fd, reason, strlen(reason));
-                            linePos = 0;
-                            buffer[bytes] = '\0';
-                            continue;  
-                        } else { //draw had been called
-                            char *decision = current->data;
-                            if (strcmp("A", decision) == 0) { //the draw was accepted
-                                char *reason = "OVER|25|D|A draw has been reached.|";
-                                write(con->fd, reason, strlen(reason));
-                                fdList *otherFd;
-                                if (con->fd == currentGame->playerOne) {
-                                    write(currentGame->playerTwo, reason, strlen(reason));
-                                    otherFd = searchFileList(currentGame->playerTwo);
-                                } else {
-                                    write(currentGame->playerOne, reason, strlen(reason));
-                                    otherFd = searchFileList(currentGame->playerOne);
-                                }
-                                pthread_mutex_lock(&lock);
-                                yourFd->finished = 1;
-                                otherFd->finished = 1;
-                                deleteGame(currentGame, gameList);
-
-                                pthread_mutex_unlock(&lock);
-                                close(yourFd->fileDescriptor);
-                                close(otherFd->fileDescriptor);
-                            } else { //the draw was denied
-                                char *decision = "DRAW|2|R|";
-                                write(currentGame->olive, decision, strlen(decision));
-                                pthread_mutex_lock(&lock);
-                                currentGame->olive = con->fd;
-                                if (currentGame->turn == 0) {
-                                    currentGame->turn = 1;
-                                } else {
-                                    currentGame->turn = 0;
-                                }
-                                pthread_mutex_unlock(&lock);
-                            }
-                            currentGame->draw = 0;
-                            currentGame->olive = 0;
-                        }
-                    } else {
-                        list = freeRL(list);
-                        char *reason = "INVL|16|Invalid command|";
-                        write(con->fd, reason, strlen(reason));
-                        if (yourFd->ingame == 1){
-                            Game *thisGame = findGame(gameList, con->fd);
-                            char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                            fdList *otherFd;
-                            if (con->fd == thisGame->playerOne) {
-                                write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerTwo);
-                            } else { //con->fd is player Two
-                                write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                                otherFd = searchFileList(thisGame->playerOne);
-                            }
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            otherFd->finished = 1;
-                                deleteGame(thisGame, gameList);
-
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                            close(otherFd->fileDescriptor);
-                        } else { //not in a game
-                            pthread_mutex_lock(&lock);
-                            yourFd->finished = 1;
-                            pthread_mutex_unlock(&lock);
-                            close(yourFd->fileDescriptor);
-                        }
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;
-                        linePos = 0;
-                        buffer[bytes] = '\0';
-                        break;
-                    }
-                    
-                    
-//None of these commands - return INVL
-                } else { // err - not a valid command
-                    list = freeRL(list);
-                    char *reason = "INVL|16|Invalid command|";
-                    write(con->fd, reason, strlen(reason));
-                    if (yourFd->ingame == 1){
-                        Game *thisGame = findGame(gameList, con->fd);
-                        char *whatHappened = "OVER|24|W|Opponent has resigned|";
-                        fdList *otherFd;
-                        if (con->fd == thisGame->playerOne) {
-                            write(thisGame->playerTwo, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerTwo);
-                        } else { //con->fd is player Two
-                            write(thisGame->playerOne, whatHappened, strlen(whatHappened));
-                            otherFd = searchFileList(thisGame->playerOne);
-                        }
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        otherFd->finished = 1;
-                        deleteGame(thisGame, gameList);
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                        close(otherFd->fileDescriptor);
-                    } else { //not in a game
-                        pthread_mutex_lock(&lock);
-                        yourFd->finished = 1;
-                        pthread_mutex_unlock(&lock);
-                        close(yourFd->fileDescriptor);
-                    }
-                    linePos = 0;
-                    buffer[bytes] = '\0';
-                    break;
-                }
+    if (engine == ENGINE_URING) {
+        run_uring_loop(shard->listener);
+    } else {
+        run_event_loop(shard->listener);
+    }
+    pools_flush();
+    log_release();
+    return NULL;
+}
 
-//////////////////////////////////////////////////////////////
+// starts the workers and waits for a signal, then wakes every worker so it notices
+void run_workers(sigset_t *mask){
+    sigset_t old;
+    uint64_t one = 1;
+    int error;
 
-                if (list != NULL){
-				    list = freeRL(list);
-                }
+    // workers inherit the blocked mask, so signals only reach this thread
+    error = pthread_sigmask(SIG_BLOCK, mask, &old);
+    if (error != 0) {
+        fprintf(stderr, "sigmask: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
 
-                // fputs("> ", stderr);
+    for (int i = 0; i < nshards; i++) {
+        error = pthread_create(&shards[i].tid, NULL, run_worker, &shards[i]);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    while (active) sigsuspend(&old);
 
-				linePos = 0;
-			}
-		}
-        buffer[bytes] = '\0';
+    for (int i = 0; i < nshards; i++) {
+        if (write(shards[i].wakefd, &one, sizeof(one)) == -1) perror("eventfd");
+    }
+    for (int i = 0; i < nshards; i++) {
+        pthread_join(shards[i].tid, NULL);
+        printf("worker %d: %ld games (%ld by challenge), %ld players handed in, %ld handed out\n",
+            i, shards[i].games, shards[i].challenges, shards[i].handoffsIn, shards[i].handoffsOut);
     }
-    free(lineBuffer);
 
-    fdList *inQuestion = searchFileList(con->fd);
-    if (inQuestion && inQuestion->finished == 1) {
-        deleteFd(con->fd, fileDescriptors);
-        free(con);
-        return NULL;  // Early return to prevent double-free
-    } else if (bytes == 0) { //file quit
-		printf("[%s:%s] got EOF\n", host, port);
-        if (ingame == 0){
-            if (inQuestion->finished == 1){ //file quit after game finished
-                deleteFd(con->fd, fileDescriptors);
-                close(con->fd);
-            } else { //file left before game started
-                deleteFd(con->fd, fileDescriptors);
-                close(con->fd);
-                traverseFileDescriptors(fileDescriptors);
-            }
-        } else if (ingame == 1){ //file quit in-game
-            Game *currentGame = findGame(gameList, con->fd);
-            if (searching == 1){ //quit while searching for game
-                if (inQuestion->ingame == 1){ //if disconnect before making a move
-                    char *whatHappened = "OVER|24|W|Opponent disconnected|";
-                    if (con->fd == currentGame->playerOne) {
-                        printf("%s\n", whatHappened);
-                        write(currentGame->playerTwo, whatHappened, strlen(whatHappened));
-                        deleteFd(currentGame->playerOne, fileDescriptors);
-                        close(currentGame->playerOne);
-                    } else { //con->fd is player Two
-                        printf("%s\n", whatHappened);
-                        write(currentGame->playerOne, whatHappened, strlen(whatHappened));
-                        deleteFd(currentGame->playerTwo, fileDescriptors);
-                        close(currentGame->playerTwo);
-                    }
-                    close(con->fd);
-                    deleteGame(currentGame, gameList);
-
-                } else { //quit while searching
-                    deleteGame(currentGame, gameList);
-                    deleteFd(con->fd, fileDescriptors);
-                    close(con->fd);
-                    traverseGames(gameList);
-                    traverseFileDescriptors(fileDescriptors);
-                }
-            } else { //quit after making a move
-                char *whatHappened = "OVER|24|W|Opponent disconnected|";
-                if (con->fd == currentGame->playerOne) {
-                    printf("%s\n", whatHappened);
-                    write(currentGame->playerTwo, whatHappened, strlen(whatHappened));
-                    close(currentGame->playerOne);
-                    deleteFd(currentGame->playerOne, fileDescriptors);
-                } else { //con->fd is player Two
-                    printf("%s\n", whatHappened);
-                    write(currentGame->playerOne, whatHappened, strlen(whatHappened));
-                    close(currentGame->playerTwo);
-                    deleteFd(currentGame->playerTwo, fileDescriptors);
-                }
-                close(con->fd);
-                deleteGame(currentGame, gameList);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// stats listener: a thread of its own answers every connection to the -s port (on localhost only)
+// with the counters in Prometheus' text format; it only reads counters, never a game or stripe lock
+#define STATS_PAGE 32768
+#define STATS_POLL_MS 200 // how often the stats thread checks whether the server is shutting down
+
+char *statsPort = NULL;
+int statsListener = -1;
+pthread_t statsThread;
+
+// appends to the page, whatever does not fit is cut
+void stats_printf(char *page, int *len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void stats_printf(char *page, int *len, const char *fmt, ...){
+    va_list ap;
+    if (*len >= STATS_PAGE) return;
+    va_start(ap, fmt);
+    int n = vsnprintf(page + *len, STATS_PAGE - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0) *len = *len + n < STATS_PAGE ? *len + n : STATS_PAGE - 1;
+}
+
+void stats_metric(char *page, int *len, const char *name, const char *type, const char *help){
+    stats_printf(page, len, "# HELP ttts_%s %s\n# TYPE ttts_%s %s\n", name, help, name, type);
+}
 
+// the whole scrape, returns its length
+int stats_render(char *page){
+    long c[STATS];
+    int len = 0, waiting = 0;
+
+    stats_sum(c);
+    for (int i = 0; i < nshards; i++) {
+        for (int v = 0; v < VARIANTS; v++) waiting += __atomic_load_n(&shards[i].waiting[v], __ATOMIC_RELAXED);
+    }
+
+    stats_metric(page, &len, "connections_accepted_total", "counter", "Connections accepted.");
+    stats_printf(page, &len, "ttts_connections_accepted_total %ld\n", c[STAT_ACCEPTED]);
+    stats_metric(page, &len, "connections_open", "gauge", "Connections accepted and not yet closed.");
+    stats_printf(page, &len, "ttts_connections_open %ld\n", c[STAT_ACCEPTED] - c[STAT_CLOSED]);
+    stats_metric(page, &len, "players_waiting", "gauge", "Players waiting for an opponent.");
+    stats_printf(page, &len, "ttts_players_waiting %d\n", waiting);
+    stats_metric(page, &len, "games_started_total", "counter", "Games started.");
+    stats_printf(page, &len, "ttts_games_started_total %ld\n", c[STAT_GAMES_STARTED]);
+    stats_metric(page, &len, "games_active", "gauge", "Games being played.");
+    stats_printf(page, &len, "ttts_games_active %ld\n", c[STAT_GAMES_STARTED] - c[STAT_GAMES_ENDED]);
+    stats_metric(page, &len, "forfeits_total", "counter", "Games lost by leaving them.");
+    stats_printf(page, &len, "ttts_forfeits_total{cause=\"disconnect\"} %ld\n", c[STAT_LEFT]);
+    stats_printf(page, &len, "ttts_forfeits_total{cause=\"overflow\"} %ld\n", c[STAT_OVERFLOWED]);
+    stats_printf(page, &len, "ttts_forfeits_total{cause=\"timeout\"} %ld\n", c[STAT_EXPIRED]);
+    stats_metric(page, &len, "timeouts_total", "counter", "Connections dropped for missing a deadline, by deadline.");
+    for (int i = 0; i < TIMEOUTS; i++) {
+        stats_printf(page, &len, "ttts_timeouts_total{deadline=\"%s\"} %ld\n", timeoutNames[i], c[STAT_TIMEOUT + i]);
+    }
+    stats_metric(page, &len, "messages_total", "counter", "Messages received, by command.");
+    for (int i = 0; i < COMMANDS; i++) {
+        stats_printf(page, &len, "ttts_messages_total{command=\"%s\"} %ld\n", commands[i].opcode, c[STAT_COMMAND + i]);
+    }
+    stats_printf(page, &len, "ttts_messages_total{command=\"unknown\"} %ld\n", c[STAT_COMMAND + COMMANDS]);
+    stats_metric(page, &len, "invalid_total", "counter", "INVL replies sent, by reason.");
+    for (int i = 0; i < REPLIES; i++) {
+        if (strcmp(fixedText[i][0], "INVL") != 0) continue;
+        int size = strlen(fixedText[i][1]) - 1; // without its '|'
+        stats_printf(page, &len, "ttts_invalid_total{reason=\"%.*s\"} %ld\n", size, fixedText[i][1], c[STAT_REPLY + i]);
+    }
+    stats_metric(page, &len, "command_seconds", "summary",
+        "Command latency by stage: parse, update (its handler), write, total from read to last write, and cpu.");
+    for (int i = 0; i < COMMANDS; i++) {
+        for (int stage = 0; stage < LAT_STAGES; stage++) {
+            struct hdr h;
+            long permille[] = { 500, 990, 999 };
+            const char *quantiles[] = { "0.5", "0.99", "0.999" };
+            stats_latency(i, stage, &h);
+            for (int q = 0; q < 3; q++) {
+                stats_printf(page, &len, "ttts_command_seconds{command=\"%s\",stage=\"%s\",quantile=\"%s\"} %.9f\n",
+                    commands[i].opcode, latStages[stage], quantiles[q], hdr_permille(&h, permille[q]) / 1e9);
             }
-            
+            stats_printf(page, &len, "ttts_command_seconds_sum{command=\"%s\",stage=\"%s\"} %.9f\n",
+                commands[i].opcode, latStages[stage], h.sum / 1e9);
+            stats_printf(page, &len, "ttts_command_seconds_count{command=\"%s\",stage=\"%s\"} %ld\n",
+                commands[i].opcode, latStages[stage], h.samples);
         }
-	} else if (bytes == -1) {
-		printf("[%s:%s] terminating: %s\n", host, port, strerror(errno));
-	} else {
-		printf("[%s:%s] terminating\n", host, port);
-	}
-    
-    free(con);
-    return NULL;
+    }
+    stats_metric(page, &len, "received_bytes_total", "counter", "Bytes read from players.");
+    stats_printf(page, &len, "ttts_received_bytes_total %ld\n", c[STAT_BYTES_IN]);
+    stats_metric(page, &len, "sent_bytes_total", "counter", "Bytes written to players.");
+    stats_printf(page, &len, "ttts_sent_bytes_total %ld\n", c[STAT_BYTES_OUT]);
+    return len;
 }
 
-// Added cleanup functions before main()
-void cleanup_games(void) {
-    struct Game *current = gameList;
-    while (current != NULL) {
-        struct Game *next = current->next;
-        if (current->playerOneName) free(current->playerOneName);
-        if (current->playerTwoName) free(current->playerTwoName);
-        if (current->grid) free(current->grid);
-        free(current);
-        current = next;
+// reads the request up to its blank line (closing on unread input would reset the connection) and answers it
+void stats_reply(int fd){
+    struct timeval wait = { 1, 0 };
+    char request[1024], head[160];
+    char *page = malloc(STATS_PAGE);
+    int got = 0, n;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+    while (got < (int)sizeof(request) - 1 && (n = read(fd, request + got, sizeof(request) - 1 - got)) > 0) {
+        got += n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+    if (page == NULL) return;
+    int len = stats_render(page);
+    int headLen = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %d\r\nConnection: close\r\n\r\n", len);
+    if (write(fd, head, headLen) == headLen) {
+        for (int off = 0; off < len && (n = write(fd, page + off, len - off)) > 0; off += n);
     }
-    gameList = NULL;
+    free(page);
 }
 
-void cleanup_fds(void) {
-    struct fdList *current = fileDescriptors;
-    while (current != NULL) {
-        struct fdList *next = current->next;
-        close(current->fileDescriptor);
-        free(current);
-        current = next;
+void *stats_serve(void *arg){
+    struct pollfd pfd = { statsListener, POLLIN, 0 };
+    (void)arg;
+
+    while (active) {
+        if (poll(&pfd, 1, STATS_POLL_MS) <= 0) continue;
+        int fd = accept(statsListener, NULL, NULL);
+        if (fd < 0) continue;
+        stats_reply(fd);
+        close(fd);
     }
-    fileDescriptors = NULL;
+    return NULL;
 }
 
-int main(int argc, char **argv){
-    sigset_t mask;
-    struct connection_data *con;
+int stats_start(void){
+    sigset_t all, old;
     int error;
-    pthread_t tid;
 
-    char *service = argc == 2 ? argv[1] : argv[2];
+    statsListener = open_listener("localhost", statsPort, QUEUE_SIZE, 0);
+    if (statsListener < 0) return -1;
+    // signals are for the threads serving players
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    error = pthread_create(&statsThread, NULL, stats_serve, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error != 0) {
+        fprintf(stderr, "stats: %s\n", strerror(error));
+        close(statsListener);
+        statsListener = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// called once active is 0, the thread notices within STATS_POLL_MS
+void stats_stop(void){
+    if (statsListener < 0) return;
+    pthread_join(statsThread, NULL);
+    close(statsListener);
+    statsListener = -1;
+}
+
+void usage(char *prog){
+    fprintf(stderr, "usage: %s [-m threads|epoll|uring] [-w workers] [-t pool size] [-l lock stripes] [-p max players] [-b side,k] [-o forfeit|disconnect] [-v log level 0-3] [-s stats port] [-T handshake,lobby,line,move seconds] port\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// bench/micro.c compiles this file in with its own main()
+#ifndef TTTS_NO_MAIN
+int main(int argc, char **argv){
+    sigset_t mask;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:w:t:l:p:b:o:v:s:T:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "threads") == 0) engine = ENGINE_THREADS;
+            else if (strcmp(optarg, "epoll") == 0) engine = ENGINE_EPOLL;
+            else if (strcmp(optarg, "uring") == 0) engine = ENGINE_URING;
+            else usage(argv[0]);
+            break;
+        case 'w':
+            nshards = atoi(optarg);
+            if (nshards < 1) usage(argv[0]);
+            break;
+        case 't':
+            poolSize = atoi(optarg);
+            if (poolSize < 2) usage(argv[0]); // a game needs both of its players served
+            break;
+        case 'l':
+            nstripes = atoi(optarg);
+            if (nstripes < 1 || (nstripes & (nstripes - 1)) != 0) usage(argv[0]);
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d,%d", &boardSide, &boardRun) != 2) usage(argv[0]);
+            if (wide_setup(boardSide, boardRun) == -1) usage(argv[0]);
+            wideBoards = boardSide != 3 || boardRun != 3;
+            break;
+        case 'p':
+            arenaPlayers = atoi(optarg);
+            if (arenaPlayers < 2) usage(argv[0]);
+            break;
+        case 'o':
+            if (strcmp(optarg, "forfeit") == 0) overflowPolicy = OVERFLOW_FORFEIT;
+            else if (strcmp(optarg, "disconnect") == 0) overflowPolicy = OVERFLOW_DISCONNECT;
+            else usage(argv[0]);
+            break;
+        case 'v':
+            logLevel = atoi(optarg);
+            if (logLevel < LOG_ERROR || logLevel > LOG_DEBUG) usage(argv[0]);
+            break;
+        case 's':
+            statsPort = optarg;
+            break;
+        case 'T':
+            if (sscanf(optarg, "%d,%d,%d,%d", &timeouts[TIMEOUT_HANDSHAKE], &timeouts[TIMEOUT_LOBBY],
+                    &timeouts[TIMEOUT_LINE], &timeouts[TIMEOUT_MOVE]) != 4) usage(argv[0]);
+            for (int i = 0; i < TIMEOUTS; i++) {
+                if (timeouts[i] < 0) usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
 
-    if (argc < 2) { 
+    if (argc - optind < 1) { 
         puts("Need an argument for port");
 	    exit(EXIT_FAILURE);
-    } else if (argc > 2) {
+    } else if (argc - optind > 1) {
         puts("Too many arguments");
 	    exit(EXIT_FAILURE);
     }
-
-	install_handlers(&mask);
-	
-    int listener = open_listener(service, QUEUE_SIZE);
-    if (listener < 0) exit(EXIT_FAILURE);
-    
-    if (pthread_mutex_init(&lock, NULL) != 0) {
-        printf("\nMutex init has failed\n");
-        return 1;
+    char *service = argv[optind];
+    if (nshards > 1 && engine == ENGINE_THREADS) {
+        puts("-w needs an event-loop engine (-m epoll or -m uring)");
+        exit(EXIT_FAILURE);
     }
 
-    printf("Listening for incoming connections on %s\n", service);
-    while (active) {
-    	con = (struct connection_data *)malloc(sizeof(struct connection_data));
-    	con->addr_len = sizeof(struct sockaddr_storage);
-    
-        con->fd = accept(listener, (struct sockaddr *)&con->addr, &con->addr_len);
+	install_handlers(&mask);
 
-        if (con->fd < 0) {
-            if (!active) {  //check if interrupted by signal
-                free(con);
-                break;
-            }
-            perror("accept");
-            free(con);
-            continue;
-        }
-        // insert(con->fd, linkedList);
+    pools_init();
+    board_init();
+    replies_init();
+    commands_init();
+    if (arenaPlayers > 0 && pools_reserve(arenaPlayers) == -1) {
+        perror("arena");
+        exit(EXIT_FAILURE);
+    }
+    if (names_init() == -1) {
+        perror("names");
+        exit(EXIT_FAILURE);
+    }
+    shards = calloc(nshards, sizeof(struct shard));
+    for (int i = 0; i < nshards; i++) {
+        if (shard_init(&shards[i], i) == -1) exit(EXIT_FAILURE);
+        shards[i].listener = open_listener(NULL, service, QUEUE_SIZE, nshards > 1);
+        if (shards[i].listener < 0) exit(EXIT_FAILURE);
+    }
+    shard = &shards[0];
+
+    char *engines[] = { "threads", "epoll", "io_uring" };
+    printf("Listening for incoming connections on %s (%s", service, engines[engine]);
+    if (nshards > 1) printf(", %d workers", nshards);
+    if (engine == ENGINE_THREADS) printf(", pool of %d, %d lock stripes", poolSize, nstripes);
+    if (arenaPlayers > 0) printf(", arena for %d players", arenaPlayers);
+    if (wideBoards) printf(", %dx%d boards, %d in a row wins", boardSide, boardSide, boardRun);
+    if (statsPort != NULL) printf(", stats on localhost:%s", statsPort);
+    printf(", timeouts %d,%d,%d,%d s", timeouts[TIMEOUT_HANDSHAKE], timeouts[TIMEOUT_LOBBY],
+        timeouts[TIMEOUT_LINE], timeouts[TIMEOUT_MOVE]);
+    puts(")");
+    if (log_start(logLevel, dump_tables) == -1) exit(EXIT_FAILURE);
+    if (statsPort != NULL && stats_start() == -1) exit(EXIT_FAILURE);
+    if (nshards > 1) {
+        run_workers(&mask);
+    } else if (engine == ENGINE_URING) {
+        run_uring_loop(shard->listener);
+    } else if (engine == ENGINE_EPOLL) {
+        run_event_loop(shard->listener);
+    } else {
+        run_threads(shard->listener, &mask);
+    }
+    stats_stop();
+    log_stop();
 
-        // temporarily disable signals
-        // (the worker thread will inherit this mask, ensuring that SIGINT is
-        // only delivered to this thread)
-        error = pthread_sigmask(SIG_BLOCK, &mask, NULL);
-        if (error != 0) {
-        	fprintf(stderr, "sigmask: %s\n", strerror(error));
-        	exit(EXIT_FAILURE);
-        }
-        
+    puts("Shutting down");
 
-        error = pthread_create(&tid, NULL, read_data, con);
-        if (error != 0) {
-        	fprintf(stderr, "pthread_create: %s\n", strerror(error));
-        	close(con->fd);
-        	free(con);
-        	continue;
-        }
-        
-        // automatically clean up child threads once they terminate
-        pthread_detach(tid);
-        
-        // unblock handled signals
-        error = pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
-        if (error != 0) {
-        	fprintf(stderr, "sigmask: %s\n", strerror(error));
-        	exit(EXIT_FAILURE);
+    long batches = 0, replies = 0, writes = 0;
+    for (int i = 0; i < nshards; i++) {
+        batches += shards[i].batches;
+        replies += shards[i].batchReplies;
+        writes += shards[i].batchWrites;
+    }
+    if (batches > 0) {
+        printf("pipelining: %ld batches, %ld replies in %ld writes, %ld syscalls saved (%.2f per batch)\n",
+            batches, replies, writes, replies - writes, (double)(replies - writes) / batches);
+    }
+    long runs = 0, lines = 0, foreign = 0, waits = 0;
+    for (int i = 0; i < nshards; i++) {
+        runs += shards[i].actorRuns;
+        lines += shards[i].actorLines;
+        foreign += shards[i].actorForeign;
+        waits += shards[i].actorWaits;
+    }
+    if (runs > 0) {
+        printf("game actors: %ld runs, %ld lines (%.2f per run), %ld run by the opponent's thread, %ld posts waited\n",
+            runs, lines, (double)lines / runs, foreign, waits);
+    }
+    long totals[STATS];
+    stats_sum(totals);
+    printf("commands:");
+    for (int c = 0; c < COMMANDS; c++) printf(" %s %ld,", commands[c].opcode, totals[STAT_COMMAND + c]);
+    printf(" unknown %ld\n", totals[STAT_COMMAND + COMMANDS]);
+    printf("timeouts:");
+    for (int i = 0; i < TIMEOUTS; i++) printf(" %s %ld%s", timeoutNames[i], totals[STAT_TIMEOUT + i], i < TIMEOUTS - 1 ? "," : "\n");
+    for (int c = 0; c < COMMANDS; c++) {
+        for (int stage = 0; stage < LAT_STAGES; stage++) {
+            struct hdr h;
+            stats_latency(c, stage, &h);
+            if (h.samples == 0) continue;
+            printf("%s %s: %ld samples, p50 %.1f us, p99 %.1f us, p999 %.1f us\n", commands[c].opcode,
+                latStages[stage], h.samples, hdr_permille(&h, 500) / 1e3, hdr_permille(&h, 990) / 1e3,
+                hdr_permille(&h, 999) / 1e3);
         }
     }
-
-    puts("Shutting down");
+    struct histogram matchTimes = { { 0 }, 0 };
+    for (int i = 0; i < nshards; i++) hist_merge(&matchTimes, &shards[i].matchTimes);
+    hist_print("time to match", &matchTimes);
     
     // Fixed cleanup before exit
-    cleanup_games();
-    cleanup_fds();
-    
-    // Destroy the mutex
-    pthread_mutex_destroy(&lock);
-    
-    close(listener);
+    for (int i = 0; i < nshards; i++) {
+        shard = &shards[i];
+        cleanup_games();
+        cleanup_fds();
+        shard_free();
+        close(shard->listener);
+    }
+    free(shards);
+    names_free();
+    stats_free();
+    pools_flush();
+    pools_print();
+    pools_free();
     
     // returning from main() (or calling exit()) immediately terminates all
     // remaining threads
@@ -2109,4 +4539,5 @@ int main(int argc, char **argv){
 	// and use pthread_cancel() or pthread_kill() to wake each one
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif